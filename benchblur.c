@@ -0,0 +1,168 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <X11/Xlib.h>
+
+#include "arg.h"
+#include "pool.h"
+#include "util.h"
+#include "boxblur.h"
+#include "iirblur.h"
+#include "stackblur.h"
+#include "stacktint.h"
+char *argv0;
+
+#define LENGTH(X)  (sizeof X / sizeof X[0])
+
+/* menu-high strips of 1080p to 8K screens */
+static const int widths[] = { 1920, 2560, 3840, 7680 };
+static const int radii[] = { 5, 10, 20, 40 };
+static const unsigned int threads[] = { 1, 2, 4, 8 };
+
+static const char *kernels[] = {
+	[StackBlurScalar] = "stack-scalar",
+	[StackBlurSSE2]   = "stack-sse2",
+	[StackBlurSSSE3]  = "stack-ssse3",
+	[StackBlurAVX2]   = "stack-avx2",
+};
+
+static int csv = 0;
+static int height = 400;
+static int runs = 5;
+
+static void
+tint(XImage *image, int radius, unsigned int num_threads)
+{
+	unsigned char t[3] = { 0x55, 0x90, 0x00 };
+
+	stacktint(image, t, num_threads);
+}
+
+static void
+stack(XImage *image, int radius, unsigned int num_threads)
+{
+	stackblur(image, 0, 0, image->width, image->height, radius, num_threads);
+}
+
+static void
+box(XImage *image, int radius, unsigned int num_threads)
+{
+	boxblur(image, 0, 0, image->width, image->height, radius, num_threads);
+}
+
+static void
+iir(XImage *image, int radius, unsigned int num_threads)
+{
+	iirblur(image, 0, 0, image->width, image->height, radius, num_threads);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* best of runs, after one to warm up caches and the pool */
+static double
+measure(void (*pass)(XImage *, int, unsigned int), XImage *image, int radius, unsigned int num_threads)
+{
+	double t, best = 0;
+	int i;
+
+	pass(image, radius, num_threads);
+	for (i = 0; i < runs; i++) {
+		t = now();
+		pass(image, radius, num_threads);
+		t = now() - t;
+		if (!i || t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void
+sweep(const char *name, void (*pass)(XImage *, int, unsigned int), int noradius)
+{
+	XImage image;
+	double ms, ms1 = 0;
+	size_t i, j, k, n;
+
+	memset(&image, 0, sizeof(image));
+	image.format = ZPixmap;
+	image.bits_per_pixel = 32;
+	image.depth = 24;
+	image.height = height;
+	for (i = 0; i < LENGTH(widths); i++) {
+		image.width = widths[i];
+		image.bytes_per_line = image.width * 4;
+		n = (size_t)image.bytes_per_line * image.height;
+		image.data = ecalloc(1, n);
+		for (j = 0; j < n; j++)
+			image.data[j] = (j * 7 + j / image.bytes_per_line * 13) & 0xff;
+		for (j = 0; j < (noradius ? 1 : LENGTH(radii)); j++) {
+			for (k = 0; k < LENGTH(threads); k++) {
+				/* the pool keeps its first size, start it again */
+				pool_free();
+				pool_init(threads[k]);
+				ms = measure(pass, &image, noradius ? 0 : radii[j], threads[k]);
+				if (!k)
+					ms1 = ms * threads[k];
+				printf(csv ? "%s,%d,%d,%d,%u,%.3f,%.1f,%.2f\n"
+				           : "%-13s %5dx%-4d r%-3d %2u threads %9.3f ms %8.1f Mpx/s %5.2f\n",
+				       name, image.width, image.height, noradius ? 0 : radii[j], threads[k],
+				       ms, image.width * image.height / ms / 1e3, ms1 / (ms * threads[k]));
+				fflush(stdout);
+			}
+		}
+		free(image.data);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-c] [-h height] [-n runs]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int k;
+
+	ARGBEGIN {
+	case 'c':
+		csv = 1;
+		break;
+	case 'h':
+		height = atoi(EARGF(usage()));
+		break;
+	case 'n':
+		runs = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	} ARGEND;
+	if (argc || height < 1 || runs < 1)
+		usage();
+
+	if (csv)
+		puts("kernel,width,height,radius,threads,ms,mpx_per_s,efficiency");
+	/* kernels this CPU lacks fall back to others, those are skipped */
+	for (k = 0; k < StackBlurLast; k++)
+		if (stackblur_setkernel(k) == k)
+			sweep(kernels[k], stack, 0);
+	stackblur_setkernel(StackBlurLast - 1);
+	sweep("box", box, 0);
+	sweep("iir", iir, 0);
+	sweep("tint", tint, 1);
+	pool_free();
+
+	return 0;
+}
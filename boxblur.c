@@ -0,0 +1,151 @@
+#include "boxblur.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+//One box of radius r along a line of n pixels, stride pixels apart in src
+//and dst, which must not overlap. Edges repeat the first and last pixel
+//like the stack blur does.
+static void boxline(unsigned char *src, int sstride, unsigned char *dst, int dstride, int n, int r) {
+	unsigned long long d=r+r+1;
+	unsigned long long inv=((1ULL<<24)+d-1)/d;
+	unsigned int rsum,gsum,bsum;
+	unsigned char *in,*out;
+	int i;
+	sstride*=4;
+	dstride*=4;
+	//Window of pixel 0: r+1 copies of the first pixel and the r after it
+	rsum=src[2]*(r+1);
+	gsum=src[1]*(r+1);
+	bsum=src[0]*(r+1);
+	for (i=1;i<=r;i++) {
+		in=src+MIN(i,n-1)*sstride;
+		rsum+=in[2];
+		gsum+=in[1];
+		bsum+=in[0];
+	}
+	in=src+MIN(r+1,n-1)*sstride;
+	out=src;
+	for (i=0;i<n;i++) {
+		dst[0]=(unsigned char)(((bsum+d/2)*inv)>>24);
+		dst[1]=(unsigned char)(((gsum+d/2)*inv)>>24);
+		dst[2]=(unsigned char)(((rsum+d/2)*inv)>>24);
+		dst[3]=0xff;
+		dst+=dstride;
+		rsum+=in[2]-out[2];
+		gsum+=in[1]-out[1];
+		bsum+=in[0]-out[0];
+		if (i+r+2<n)
+			in+=sstride;
+		if (i>=r)
+			out+=sstride;
+	}
+}
+
+void *HBoxRenderingThread(void *arg) {
+	BoxBlurRenderingParams *rp=(BoxBlurRenderingParams*)arg;
+	int y,n=rp->x2-rp->x;
+	unsigned char *a=malloc(n*4);
+	unsigned char *b=malloc(n*4);
+	unsigned char *row;
+	for (y=rp->y;y<rp->y2;y++) {
+		row=rp->pix+(y*rp->stride+rp->x)*4;
+		boxline(row,1,a,1,n,rp->radius[0]);
+		boxline(a,1,b,1,n,rp->radius[1]);
+		boxline(b,1,row,1,n,rp->radius[2]);
+	}
+	free(a);
+	free(b);
+	return NULL;
+}
+
+//Columns go through a and b a strip at a time, so the lines of the strip
+//stay in cache between the three boxes
+void *VBoxRenderingThread(void *arg) {
+	BoxBlurRenderingParams *rp=(BoxBlurRenderingParams*)arg;
+	int x,c,cols,n=rp->y2-rp->y;
+	unsigned char *a=malloc(n*BOXBLUR_STRIP*4);
+	unsigned char *b=malloc(n*BOXBLUR_STRIP*4);
+	unsigned char *col;
+	for (x=rp->x;x<rp->x2;x+=BOXBLUR_STRIP) {
+		cols=MIN(BOXBLUR_STRIP,rp->x2-x);
+		col=rp->pix+(rp->y*rp->stride+x)*4;
+		for (c=0;c<cols;c++)
+			boxline(col+c*4,rp->stride,a+c*4,BOXBLUR_STRIP,n,rp->radius[0]);
+		for (c=0;c<cols;c++)
+			boxline(a+c*4,BOXBLUR_STRIP,b+c*4,BOXBLUR_STRIP,n,rp->radius[1]);
+		for (c=0;c<cols;c++)
+			boxline(b+c*4,BOXBLUR_STRIP,col+c*4,rp->stride,n,rp->radius[2]);
+	}
+	free(a);
+	free(b);
+	return NULL;
+}
+
+//Box radii whose sum of variances, (w*w-1)/12 for width w each, is closest
+//to the r(r+2)/6 of a stack blur of the given radius
+static void boxradii(int radius, int *r) {
+	double s2=radius*(radius+2)/6.0;
+	int wl=(int)floor(sqrt(4*s2+1)),m,i;
+	if (wl%2==0)
+		wl--;
+	m=(int)floor((12*s2-3.0*wl*wl-12.0*wl-9)/(-4.0*wl-4)+0.5);
+	for (i=0;i<3;i++)
+		r[i]=((i<m?wl:wl+2)-1)/2;
+}
+
+void boxblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads) {
+	if (radius<1)
+		return;
+	int i,r[3];
+	boxradii(radius,r);
+
+	PoolGroup group={0};
+	pool_init(num_threads);
+	//Row tiles then column tiles, see stackblur()
+	int tiles=num_threads*BOXBLUR_TILES_PER_THREAD;
+	int tileH=MAX(1,(h+tiles-1)/tiles);
+	int tileW=MAX(1,(w+tiles-1)/tiles);
+	tileW=(tileW+BOXBLUR_STRIP-1)/BOXBLUR_STRIP*BOXBLUR_STRIP;
+	int nh=(h+tileH-1)/tileH;
+	int nv=(w+tileW-1)/tileW;
+	BoxBlurRenderingParams *rp=malloc((nh+nv)*sizeof(BoxBlurRenderingParams));
+	for (i=0;i<nh+nv;i++) {
+		rp[i].pix=(unsigned char*)image->data;
+		rp[i].stride=image->bytes_per_line/4;
+		if (i<nh) {
+			rp[i].x=x;
+			rp[i].x2=x+w;
+			rp[i].y=y+i*tileH;
+			rp[i].y2=MIN(rp[i].y+tileH,y+h);
+		} else {
+			rp[i].x=x+(i-nh)*tileW;
+			rp[i].x2=MIN(rp[i].x+tileW,x+w);
+			rp[i].y=y;
+			rp[i].y2=y+h;
+		}
+		rp[i].radius[0]=r[0];
+		rp[i].radius[1]=r[1];
+		rp[i].radius[2]=r[2];
+	}
+#ifdef DEBUG
+	fprintf(stdout,"Box radii: %i %i %i\n",r[0],r[1],r[2]);
+#endif
+	for (i=0;i<nh;i++)
+		pool_submit(&group,HBoxRenderingThread,(void*)&rp[i]);
+	pool_wait(&group);
+	for (i=nh;i<nh+nv;i++)
+		pool_submit(&group,VBoxRenderingThread,(void*)&rp[i]);
+	pool_wait(&group);
+#ifdef DEBUG
+	pool_dumpstats(stdout,"boxblur");
+#endif
+	free(rp);
+	rp=NULL;
+}
+#undef MIN
+#undef MAX
@@ -0,0 +1,31 @@
+//#define DEBUG
+
+// Triple box blur
+//
+// Three box blurs in a row are close to a Gaussian. The box widths are
+// picked so that the three together have the variance of the stack blur
+// of the same radius, so switching engines keeps the look. Every box is a
+// running sum, which costs the same per pixel whatever the radius.
+
+#include <X11/Xlib.h>
+
+//Tiles queued per worker and pass, like stackblur()
+#define BOXBLUR_TILES_PER_THREAD 8
+//Columns the vertical pass walks together
+#define BOXBLUR_STRIP 16
+
+typedef struct {
+	unsigned char *pix;
+	int x;
+	int x2;
+	int y;
+	int y2;
+	int stride;
+	int radius[3];
+} BoxBlurRenderingParams;
+
+void *HBoxRenderingThread(void *arg);
+
+void *VBoxRenderingThread(void *arg);
+
+void boxblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads);
@@ -1,11 +1,16 @@
 /* See LICENSE file for copyright and license details. */
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
@@ -13,9 +18,14 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif
+#ifdef XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
 #include <X11/Xft/Xft.h>
+#include <X11/extensions/XShm.h>
 
 #include "drw.h"
+#include "pool.h"
 #include "util.h"
 
 /* macros */
@@ -24,6 +34,7 @@
 #define LENGTH(X)             (sizeof X / sizeof X[0])
 #define TEXTNW(X,N)           (drw_font_getexts_width(drw->fonts[0], (X), (N)))
 #define TEXTW(X)              (drw_text(drw, 0, 0, 0, 0, (X), 0, CPU_THREADS) + drw->fonts[0]->h)
+#define RADIXBITS             11 /* of an item index sorted on per pass, see rank() */
 
 /* enums */
 enum { SchemeFirst, SchemeNorm, SchemeSel, SchemeOut, SchemeLast }; /* color schemes */
@@ -33,7 +44,6 @@ struct item {
 	struct item *left, *right;
 	int out;
 	int number;
-	int distance;
 };
 
 static char text[BUFSIZ] = "";
@@ -42,9 +52,60 @@ static int sw, sh; /* X display screen geometry width, height */
 static int inputw, promptw;
 static size_t cursor;
 static struct item *items = NULL;
+/* what matching reads, by item index, apart from items; see readstdin() */
+static char *itemfold; /* lowercase texts one after the other */
+static size_t *itemoffs; /* of each text in itemfold */
+static unsigned int *itemlens;
+static unsigned long long *itemmasks; /* charbit()s in each item */
+static int *itemdists; /* set by fuzzyitem() */
 static struct item *matches, *matchend;
 static struct item *prev, *curr, *next, *sel;
 static int mon = -1, screen;
+static int engine; /* blurengine looked up by drw_blur_engine() */
+static int blurfd = -1; /* readable once an asynchronous blur is done */
+static pthread_t reader;
+static int readerrunning;
+static int fast; /* grab the keyboard while stdin is still read */
+static size_t nitems;
+static char *maxstr; /* longest item */
+static struct level {
+	size_t len; /* of the query prefix */
+	unsigned int *match; /* item indices, the first ranked ones sorted */
+	size_t n, ranked;
+	int inorder; /* the unranked ones are in input order */
+} *levels; /* matches of the prefixes of text, see fuzzymatch() */
+static size_t nlevels, levelcap;
+static char levelquery[BUFSIZ]; /* the query of the last level */
+static unsigned int *rankbuf; /* matchall() output, and rank() scratch */
+static size_t rankcap;
+/* The matcher thread looks for the matches of matchquery and owns levels
+ * and the item arrays they are ranked by until matchdone is matchgen. */
+static pthread_t matcher;
+static pthread_mutex_t matchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t matchcond = PTHREAD_COND_INITIALIZER;
+static char matchquery[sizeof text];
+static unsigned long matchgen, matchdone; /* of the text asked for, found */
+static unsigned long listgen; /* of the matches listed */
+static int matchquit;
+static int matchfd[2] = { -1, -1 }; /* written to when matches are found */
+#ifdef XDAMAGE
+/* windows under the menu whose damage makes it re-blur, see livetrack() */
+typedef struct {
+	Window win;
+	Damage damage;
+	int x, y, w, h;
+} Under;
+
+static int live; /* -bl and a compositor running */
+static int livex, livey; /* menu position on the root */
+static int damageevent, damageerror;
+static Under *under;
+static unsigned int nunder;
+static int retrack; /* the windows stacked under the menu changed */
+static XRectangle dirty; /* to capture and re-blur, root coordinates */
+static struct timespec lastlive;
+static int (*xerrorxlib)(Display *, XErrorEvent *);
+#endif
 
 static Atom clip, utf8;
 static Display *dpy;
@@ -59,6 +120,9 @@ static Drw *drw;
 static int (*fstrncmp)(const char *, const char *, size_t) = strncmp;
 static char *(*fstrstr)(const char *, const char *) = strstr;
 
+static int rankrest(void);
+static void matchstop(void);
+
 static void
 appenditem(struct item *item, struct item **list, struct item **last)
 {
@@ -85,9 +149,13 @@ calcoffsets(void)
 	else
 		n = mw - (promptw + inputw + TEXTW("<") + TEXTW(">"));
 	/* calculate which items will begin the next page and previous page */
-	for (i = 0, next = curr; next; next = next->right)
+	for (i = 0, next = curr; next; next = next->right) {
 		if ((i += (lines > 0) ? bh : MIN(TEXTW(next->text), n)) > n)
 			break;
+		/* the page goes past the matches ranked so far */
+		if (!next->right)
+			rankrest();
+	}
 	for (i = 0, prev = curr; prev && prev->left; prev = prev->left)
 		if ((i += (lines > 0) ? bh : MIN(TEXTW(prev->left->text), n)) > n)
 			break;
@@ -98,12 +166,14 @@ cleanup(void)
 {
 	size_t i;
 
+	matchstop();
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
 	for (i = 0; i < SchemeLast; i++) {
 		drw_clr_free(scheme[i].bg);
 		drw_clr_free(scheme[i].fg);
 	}
 	drw_free(drw);
+	pool_free();
 	XSync(dpy, False);
 	XCloseDisplay(dpy);
 }
@@ -204,84 +274,518 @@ grabkeyboard(void)
 	die("cannot grab keyboard\n");
 }
 
+/* Bit of the 64 standing for c in item and query masks: letters of either
+ * case share one, so do all bytes past ASCII, and punctuation is spread
+ * over the rest. */
 static int
-compare_distance(const void *a, const void *b)
+charbit(unsigned char c)
 {
-	struct item const *da = *(struct item **) a;
-	struct item const *db = *(struct item **) b;
-
-	if (!db)
-		return 1;
-	if (!da)
-		return -1;
-	return da->distance - db->distance;
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a';
+	if (c >= '0' && c <= '9')
+		return 26 + c - '0';
+	if (c >= 128)
+		return 63;
+	return 36 + c % 27;
 }
 
-static void
-fuzzymatch(void)
+/* Bits an item needs to match the first text_len characters of query.  A
+ * character that can match characters of two different bits, in locales
+ * where tolower() leaves ASCII, is left out. */
+static unsigned long long
+querymask(const char *query, int text_len)
 {
-	struct item *item;
-	struct item **fuzzymatches = NULL;
-	char c;
-	int number_of_matches = 0, i, pidx, sidx, eidx;
-	int text_len = strlen(text), itext_len;
-
-	matches = matchend = NULL;
+	unsigned long long mask = 0;
+	int i, lo, up;
+
+	for (i = 0; i < text_len; i++) {
+		lo = charbit(tolower((unsigned char)query[i]));
+		up = charbit(toupper((unsigned char)query[i]));
+		if (lo == up)
+			mask |= 1ULL << lo;
+	}
+	return mask;
+}
 
-	/* walk through all items */
-	for (item = items; item && item->text; item++) {
-		if (text_len) {
-			itext_len = strlen(item->text);
-			pidx = 0;
-			sidx = eidx = -1;
-			/* walk through item text */
-			for (i = 0; i < itext_len && (c = item->text[i]); i++) {
-				/* case-insensitive fuzzy match pattern */
-				if (tolower(text[pidx]) == c || toupper(text[pidx]) == c) {
-					if (sidx == -1)
-						sidx = i;
-					pidx++;
-					if (pidx == text_len) {
-						eidx = i;
-						break;
-					}
-				}
-			}
-			/* build list of matches */
-			if (eidx != -1) {
+/* Whether fold, the lowercase query of text_len characters, is a
+ * subsequence of the lowercase text of item idx, with its distance set if
+ * so. */
+static int
+fuzzyitem(unsigned int idx, const char *fold, int text_len)
+{
+	const char *s = itemfold + itemoffs[idx];
+	int i, pidx = 0, sidx = -1, itext_len = itemlens[idx];
+
+	/* walk through item text */
+	for (i = 0; i < itext_len; i++) {
+		/* case-insensitive fuzzy match pattern */
+		if (s[i] == fold[pidx]) {
+			if (sidx == -1)
+				sidx = i;
+			if (++pidx == text_len) {
 				/* compute distance */
 				/* factor in 30% of sidx and distance between eidx and total
 				 * text length .. let's see how it works */
-				item->distance = eidx - sidx + (itext_len - eidx + sidx) / 3;
-				appenditem(item, &matches, &matchend);
-				number_of_matches++;
+				itemdists[idx] = i - sidx + (itext_len - i + sidx) / 3;
+				return 1;
 			}
 		}
-		else
-			appenditem(item, &matches, &matchend);
 	}
+	return 0;
+}
+
+/* Whether text has changed since generation gen of it was asked for */
+static int
+matchstale(unsigned long gen)
+{
+	return __atomic_load_n(&matchgen, __ATOMIC_RELAXED) != gen;
+}
+
+/* Indices start to end of src, or of items when src is NULL, whose items
+ * match the query go to dst from start on, in order; stale is set instead
+ * if the query is given up on. */
+struct matchchunk {
+	unsigned int *src, *dst;
+	size_t start, end, n;
+	const char *fold; /* lowercase query */
+	int text_len;
+	unsigned long long mask; /* querymask() */
+	unsigned long gen; /* of the query */
+	int stale;
+};
+
+static void *
+matchchunk(void *arg)
+{
+	struct matchchunk *c = arg;
+	unsigned int idx, *dst = c->dst + c->start;
+	size_t i, n = 0;
+
+	/* one AND per item rules out most of them before their text is read;
+	 * without branches, over the masks alone when matching all items */
+	if (c->src)
+		for (i = c->start; i < c->end; i++) {
+			dst[n] = c->src[i];
+			n += (itemmasks[c->src[i]] & c->mask) == c->mask;
+		}
+	else
+		for (i = c->start; i < c->end; i++) {
+			dst[n] = i;
+			n += (itemmasks[i] & c->mask) == c->mask;
+		}
+	for (i = c->n = 0; i < n; i++) {
+		if (!(i & 4095) && matchstale(c->gen)) {
+			c->stale = 1;
+			return NULL;
+		}
+		if (fuzzyitem((idx = dst[i]), c->fold, c->text_len))
+			dst[c->n++] = idx;
+	}
+	return NULL;
+}
+
+/* Long lists are matched in chunks on the pool, several per thread so
+ * busy ones get help; the chunks' matches are then moved together.
+ * Returns how many there are, or -1 if generation gen went stale. */
+static ssize_t
+matchall(unsigned int *src, size_t nsrc, unsigned int *dst, const char *query, int text_len, unsigned long gen)
+{
+	struct matchchunk one, *c;
+	PoolGroup group = {0};
+	size_t i, n, nchunks, size;
+	unsigned long long mask = querymask(query, text_len);
+	char fold[sizeof text];
+	int stale;
+
+	for (i = 0; i < (size_t)text_len; i++)
+		fold[i] = tolower((unsigned char)query[i]);
+
+	if (nsrc < MATCH_THREADS_MIN || CPU_THREADS < 2) {
+		memset(&one, 0, sizeof(one));
+		one.src = src;
+		one.dst = dst;
+		one.end = nsrc;
+		one.fold = fold;
+		one.text_len = text_len;
+		one.mask = mask;
+		one.gen = gen;
+		matchchunk(&one);
+		return one.stale ? -1 : (ssize_t)one.n;
+	}
+	nchunks = CPU_THREADS * 8;
+	size = (nsrc + nchunks - 1) / nchunks;
+	c = ecalloc(nchunks, sizeof(*c));
+	pool_init(CPU_THREADS);
+	for (i = 0; i < nchunks; i++) {
+		c[i].src = src;
+		c[i].dst = dst;
+		c[i].start = MIN(i * size, nsrc);
+		c[i].end = MIN(c[i].start + size, nsrc);
+		c[i].fold = fold;
+		c[i].text_len = text_len;
+		c[i].mask = mask;
+		c[i].gen = gen;
+		pool_submit(&group, matchchunk, &c[i]);
+	}
+	pool_wait(&group);
+	for (i = n = stale = 0; i < nchunks; n += c[i++].n) {
+		stale |= c[i].stale;
+		memmove(dst + n, dst + c[i].start, c[i].n * sizeof(*dst));
+	}
+	free(c);
+	return stale ? -1 : (ssize_t)n;
+}
+
+/* Stable counting sort of the n indices in src to dst, by RADIXBITS of
+ * the index from shift on, or by distance when shift is negative; a
+ * distance is at most the length of an item, so below sizeof text.  Only
+ * one thread sorts at a time, see matchthread(). */
+static void
+countsort(unsigned int *src, unsigned int *dst, size_t n, int shift)
+{
+	static size_t distcount[sizeof text], idxcount[1 << RADIXBITS];
+	size_t *count, i, k, nkeys, sum;
+
+	if (shift < 0) {
+		count = distcount;
+		nkeys = LENGTH(distcount);
+	} else {
+		count = idxcount;
+		nkeys = LENGTH(idxcount);
+	}
+	memset(count, 0, nkeys * sizeof(*count));
+#define KEY(idx) (shift < 0 ? (size_t)itemdists[idx] : (idx) >> shift & ((1 << RADIXBITS) - 1))
+	for (i = 0; i < n; i++)
+		count[KEY(src[i])]++;
+	for (k = sum = 0; k < nkeys; k++) {
+		i = count[k];
+		count[k] = sum;
+		sum += i;
+	}
+	for (i = 0; i < n; i++)
+		dst[count[KEY(src[i])]++] = src[i];
+#undef KEY
+}
+
+/* Passes rank() needs: matches filtered from an earlier set come in its
+ * order, so they are first put back in input order, a pass for every
+ * RADIXBITS of the largest index, before the one by distance. */
+static int
+rankpasses(int inorder)
+{
+	int passes = 1;
+
+	if (!inorder)
+		for (passes++; (size_t)1 << (passes - 1) * RADIXBITS < nitems; passes++)
+			;
+	return passes;
+}
+
+/* Ranks the n matches in a by distance, ties in input order, in linear
+ * time; each pass moves them between a and b, so the result is in a after
+ * an even number of passes and in b after an odd one. */
+static void
+rank(unsigned int *a, unsigned int *b, size_t n, int passes)
+{
+	unsigned int *t;
+	int i;
+
+	for (i = 0; i < passes; i++) {
+		countsort(a, b, n, i < passes - 1 ? i * RADIXBITS : -1);
+		t = a;
+		a = b;
+		b = t;
+	}
+}
+
+/* Most items a page can show and the one starting the next: lines, or as
+ * many as fit in the bar if all were empty */
+static size_t
+pagemax(void)
+{
+	return lines > 0 ? lines + 1 : mw / drw->fonts[0]->h + 1;
+}
+
+/* Whether match a ranks before match b: by distance, ties in input order */
+static int
+before(unsigned int a, unsigned int b)
+{
+	return itemdists[a] < itemdists[b] || (itemdists[a] == itemdists[b] && a < b);
+}
+
+/* Restores the heap of n matches below i, the one ranking last on top */
+static void
+siftdown(unsigned int *heap, size_t n, size_t i)
+{
+	unsigned int t;
+	size_t c;
+
+	for (; (c = 2 * i + 1) < n; i = c) {
+		if (c + 1 < n && before(heap[c], heap[c + 1]))
+			c++;
+		if (!before(heap[i], heap[c]))
+			break;
+		t = heap[i];
+		heap[i] = heap[c];
+		heap[c] = t;
+	}
+}
+
+/* Puts the k best of the n matches in src at the start of dst, ranked, and
+ * the others after them in their order in src.  The k best so far are kept
+ * in a heap with the worst on top, so most matches cost one comparison. */
+static void
+rankfirst(unsigned int *src, unsigned int *dst, size_t n, size_t k)
+{
+	unsigned int t, worst;
+	size_t i, m;
+
+	if (!k)
+		return;
+	memcpy(dst, src, k * sizeof(*dst));
+	for (i = k / 2; i > 0; i--)
+		siftdown(dst, k, i - 1);
+	for (i = k; i < n; i++)
+		if (before(src[i], dst[0])) {
+			dst[0] = src[i];
+			siftdown(dst, k, 0);
+		}
+	worst = dst[0];
+	for (i = 0, m = k; i < n; i++)
+		if (before(worst, src[i]))
+			dst[m++] = src[i];
+	for (m = k; m > 1; siftdown(dst, m, 0)) {
+		t = dst[0];
+		dst[0] = dst[--m];
+		dst[m] = t;
+	}
+}
 
-	if (number_of_matches) {
-		/* initialize array with matches */
-		if (!(fuzzymatches = realloc(fuzzymatches, number_of_matches * sizeof(struct item*))))
-			die("cannot realloc %u bytes:", number_of_matches * sizeof(struct item *));
-		for (i = 0, item = matches; item && i < number_of_matches; i++, item = item->right)
-			fuzzymatches[i] = item;
+/* Matches past the first page are only ranked and listed once paging
+ * gets to them; returns whether there were any. */
+static int
+rankrest(void)
+{
+	struct level *l;
+	char fold[sizeof text];
+	unsigned int *rest;
+	size_t i, m;
+	int passes;
+
+	/* levels may be the matcher's, and of other text than listed */
+	if (listgen != matchgen)
+		return 0;
+	if (!nlevels) {
+		/* no query, items are listed as read */
+		if (!matchend || (i = matchend - items + 1) >= nitems)
+			return 0;
+		for (; i < nitems; i++)
+			appenditem(&items[i], &matches, &matchend);
+		return 1;
+	}
+	l = &levels[nlevels - 1];
+	if (l->ranked == l->n)
+		return 0;
+	rest = l->match + l->ranked;
+	m = l->n - l->ranked;
+	/* itemdists are those of the last query matched, maybe a longer one */
+	for (i = 0; i < l->len; i++)
+		fold[i] = tolower((unsigned char)levelquery[i]);
+	for (i = 0; i < m; i++)
+		fuzzyitem(rest[i], fold, l->len);
+	passes = rankpasses(l->inorder);
+	rank(rest, rankbuf, m, passes);
+	if (passes % 2)
+		memcpy(rest, rankbuf, m * sizeof(*rest));
+	for (i = 0; i < m; i++)
+		appenditem(&items[rest[i]], &matches, &matchend);
+	l->ranked = l->n;
+	return 1;
+}
 
-		/* sort matches according to distance */
-		qsort(fuzzymatches, number_of_matches, sizeof(struct item *), compare_distance);
-		/* rebuild list of matches */
-		matches = matchend = NULL;
-		for (i = 0, item = fuzzymatches[0]; i < number_of_matches && item && \
-				item->text; item = fuzzymatches[i], i++)
-			appenditem(item, &matches, &matchend);
+/* Anything matching a query also matches its prefixes, so the matches of
+ * every prefix typed so far are kept: typing on filters the last set
+ * only, and deleting back goes back to an earlier one.  Of each set just
+ * the first page is ranked, see rankrest() for the rest.  Returns 0 if
+ * generation gen of the query went stale before its set was done. */
+static int
+matchlevels(const char *query, unsigned long gen)
+{
+	unsigned int *src, *dst;
+	size_t common, nsrc;
+	size_t text_len = strlen(query);
+	ssize_t n;
 
-		free(fuzzymatches);
+	/* drop the sets of queries text no longer starts with */
+	for (common = 0; common < text_len && query[common] == levelquery[common]; common++)
+		;
+	while (nlevels && levels[nlevels - 1].len > common)
+		free(levels[--nlevels].match);
+
+	if (text_len && (!nlevels || levels[nlevels - 1].len < text_len)) {
+		src = nlevels ? levels[nlevels - 1].match : NULL;
+		nsrc = nlevels ? levels[nlevels - 1].n : nitems;
+		dst = ecalloc(nsrc ? nsrc : 1, sizeof(*dst));
+		if (rankcap < nsrc) {
+			rankcap = nsrc;
+			if (!(rankbuf = realloc(rankbuf, rankcap * sizeof(*rankbuf))))
+				die("cannot realloc %u bytes:", rankcap * sizeof(*rankbuf));
+		}
+		if ((n = matchall(src, nsrc, rankbuf, query, text_len, gen)) < 0) {
+			free(dst);
+			return 0;
+		}
+		/* sort the first page according to distance */
+		rankfirst(rankbuf, dst, n, MIN(n, pagemax()));
+		if (nlevels == levelcap) {
+			levelcap = levelcap ? levelcap * 2 : 16;
+			if (!(levels = realloc(levels, levelcap * sizeof(*levels))))
+				die("cannot realloc %u bytes:", levelcap * sizeof(*levels));
+		}
+		levels[nlevels].len = text_len;
+		levels[nlevels].match = dst;
+		levels[nlevels].n = n;
+		levels[nlevels].ranked = MIN(n, pagemax());
+		levels[nlevels++].inorder = !src;
+		memcpy(levelquery, query, text_len + 1);
 	}
+	return 1;
+}
+
+/* Lists the first page of the matches of the last level, for generation
+ * matchgen of text; the matcher must be done with it. */
+static void
+matchlist(void)
+{
+	size_t i, page;
+
+	matches = matchend = NULL;
+	if (nlevels)
+		for (i = 0; i < levels[nlevels - 1].ranked; i++)
+			appenditem(&items[levels[nlevels - 1].match[i]], &matches, &matchend);
+	else
+		for (i = 0, page = MIN(nitems, pagemax()); i < page; i++)
+			appenditem(&items[i], &matches, &matchend);
+	listgen = matchgen;
 	curr = sel = matches;
 	calcoffsets();
 }
 
+/* Waits for text to change, and looks for its matches meanwhile. */
+static void *
+matchthread(void *arg)
+{
+	char query[sizeof text];
+	unsigned long gen;
+	int found;
+
+	pthread_mutex_lock(&matchlock);
+	for (;;) {
+		while (!matchquit && matchdone == matchgen)
+			pthread_cond_wait(&matchcond, &matchlock);
+		if (matchquit)
+			break;
+		gen = matchgen;
+		memcpy(query, matchquery, sizeof query);
+		pthread_mutex_unlock(&matchlock);
+		found = matchlevels(query, gen);
+		pthread_mutex_lock(&matchlock);
+		if (found && gen == matchgen) {
+			matchdone = gen;
+			while (write(matchfd[1], "", 1) < 0 && errno == EINTR)
+				;
+		}
+	}
+	pthread_mutex_unlock(&matchlock);
+	return NULL;
+}
+
+/* Matching goes on a thread of its own from now on, matchfd[0] becomes
+ * readable when matches of the text as it is are found; matchread() must
+ * be called then.  Without the thread it stays synchronous. */
+static void
+matchstart(void)
+{
+	if (pipe(matchfd) < 0) {
+		matchfd[0] = matchfd[1] = -1;
+		return;
+	}
+	fcntl(matchfd[0], F_SETFL, O_NONBLOCK);
+	if (pthread_create(&matcher, NULL, matchthread, NULL)) {
+		close(matchfd[0]);
+		close(matchfd[1]);
+		matchfd[0] = matchfd[1] = -1;
+	}
+}
+
+static void
+matchstop(void)
+{
+	if (matchfd[0] < 0)
+		return;
+	pthread_mutex_lock(&matchlock);
+	matchquit = 1;
+	/* gives up on a search going on */
+	__atomic_store_n(&matchgen, matchgen + 1, __ATOMIC_RELAXED);
+	pthread_cond_signal(&matchcond);
+	pthread_mutex_unlock(&matchlock);
+	pthread_join(matcher, NULL);
+	close(matchfd[0]);
+	close(matchfd[1]);
+	matchfd[0] = matchfd[1] = -1;
+}
+
+/* Lists the matches found if they are those of the text as it is, older
+ * ones are dropped; returns whether they were listed. */
+static int
+matchread(void)
+{
+	char buf[64];
+	unsigned long done;
+
+	while (read(matchfd[0], buf, sizeof buf) > 0)
+		;
+	pthread_mutex_lock(&matchlock);
+	done = matchdone;
+	pthread_mutex_unlock(&matchlock);
+	if (done != matchgen || listgen == matchgen)
+		return 0;
+	matchlist();
+	return 1;
+}
+
+/* Anything acting on sel waits for the matches of the text as it is */
+static void
+matchwait(void)
+{
+	struct pollfd fd;
+
+	fd.fd = matchfd[0];
+	fd.events = POLLIN;
+	while (matchfd[0] >= 0 && listgen != matchgen && !matchread())
+		if (poll(&fd, 1, -1) < 0 && errno != EINTR)
+			die("poll:");
+}
+
+/* Asks the matcher for the matches of text, a newer text makes it give up
+ * on older ones; without the matcher they are listed right away. */
+static void
+fuzzymatch(void)
+{
+	if (matchfd[0] < 0) {
+		matchlevels(text, matchgen);
+		matchlist();
+		return;
+	}
+	pthread_mutex_lock(&matchlock);
+	memcpy(matchquery, text, sizeof text);
+	__atomic_store_n(&matchgen, matchgen + 1, __ATOMIC_RELAXED);
+	pthread_cond_signal(&matchcond);
+	pthread_mutex_unlock(&matchlock);
+}
+
 static void
 insert(const char *str, ssize_t n)
 {
@@ -309,6 +813,7 @@ nextrune(int inc)
 static void
 goup(unsigned int state)
 {
+	matchwait();
 	if ((!sel) || (!sel->left))
 		return;
 	if ((sel = sel->left)->right == curr) {
@@ -327,6 +832,7 @@ goup(unsigned int state)
 static void
 godown(unsigned int state)
 {
+	matchwait();
 	if ((!sel) || (!sel->right))
 		return;
 	if (sel && (sel = sel->right) == next) {
@@ -345,6 +851,7 @@ godown(unsigned int state)
 static void
 choose(unsigned int state)
 {
+	matchwait();
 	if (output_number) {
 		if (sel && !(state & ShiftMask))
 			printf("%d\n", sel->number);
@@ -458,8 +965,10 @@ keypress(XKeyEvent *ev)
 			cursor = strlen(text);
 			break;
 		}
+		matchwait();
 		if (next) {
 			/* jump to end of list and position items in reverse */
+			rankrest();
 			curr = matchend;
 			calcoffsets();
 			curr = prev;
@@ -474,6 +983,7 @@ keypress(XKeyEvent *ev)
 		cleanup();
 		exit(1);
 	case XK_Home:
+		matchwait();
 		if (sel == matches) {
 			cursor = 0;
 			break;
@@ -482,23 +992,31 @@ keypress(XKeyEvent *ev)
 		calcoffsets();
 		break;
 	case XK_Left:
-		if (cursor > 0 && (!sel || !sel->left || lines > 0)) {
+		if (lines > 0) {
+			if (cursor == 0)
+				return;
+			cursor = nextrune(-1);
+			break;
+		}
+		/* on a single line it moves the selection while it can */
+		matchwait();
+		if (cursor > 0 && (!sel || !sel->left)) {
 			cursor = nextrune(-1);
 			break;
 		}
-		if (lines > 0)
-			return;
 		/* fallthrough */
 	case XK_Up:
 		goup(ev->state);
 		break;
 	case XK_Next:
+		matchwait();
 		if (!next)
 			return;
 		sel = curr = next;
 		calcoffsets();
 		break;
 	case XK_Prior:
+		matchwait();
 		if (!prev)
 			return;
 		sel = curr = prev;
@@ -520,6 +1038,7 @@ keypress(XKeyEvent *ev)
 		godown(ev->state);
 		break;
 	case XK_Tab:
+		matchwait();
 		if (!sel)
 			return;
 		strncpy(text, sel->text, sizeof text - 1);
@@ -544,6 +1063,7 @@ buttonpress(XEvent *e)
 	/* right-click: exit */
 	if (ev->button == Button3)
 		exit(1);
+	matchwait();
 
 	//Swap forward and backward keys on single line menu
 	if (reverse_updown) {
@@ -654,68 +1174,360 @@ paste(void)
 	drawmenu();
 }
 
-static void
-readstdin(void)
+/* Runs on a thread of its own while the main thread talks to the server,
+ * so it must not touch Xlib; item widths are measured after joining.
+ * Besides items, whose text is drawn and printed as read, it fills the
+ * arrays matching streams through: lengths, masks and a lowercase copy of
+ * every text in one buffer, so no text is measured or folded per query. */
+static void *
+readstdin(void *arg)
 {
-	char buf[sizeof text], *p, *maxstr = NULL;
-	size_t i, max = 0, size = 0;
+	char buf[sizeof text], *p;
+	size_t i, len, n, max = 0, size = 0, foldlen = 0, foldsize = 0;
+	unsigned long long mask;
 
 	/* read each line from stdin and add it to the item list */
 	for (i = 0; fgets(buf, sizeof buf, stdin); i++) {
-		if (i + 1 >= size / sizeof *items)
+		if (i + 1 >= size / sizeof *items) {
 			if (!(items = realloc(items, (size += BUFSIZ))))
 				die("cannot realloc %u bytes:", size);
-		if ((p = strchr(buf, '\n')))
-			*p = '\0';
+			n = size / sizeof *items;
+			if (!(itemoffs = realloc(itemoffs, n * sizeof *itemoffs)) ||
+			    !(itemlens = realloc(itemlens, n * sizeof *itemlens)) ||
+			    !(itemmasks = realloc(itemmasks, n * sizeof *itemmasks)) ||
+			    !(itemdists = realloc(itemdists, n * sizeof *itemdists)))
+				die("cannot realloc %u items:", n);
+		}
+		for (p = buf, mask = 0; *p && *p != '\n'; p++)
+			mask |= 1ULL << charbit(*p);
+		*p = '\0';
+		len = p - buf;
+		if (foldlen + len + 1 > foldsize) {
+			foldsize = MAX(foldsize * 2, foldlen + len + 1 + BUFSIZ);
+			if (!(itemfold = realloc(itemfold, foldsize)))
+				die("cannot realloc %u bytes:", foldsize);
+		}
+		itemoffs[i] = foldlen;
+		for (p = buf; *p; p++)
+			itemfold[foldlen++] = tolower((unsigned char)*p);
+		itemfold[foldlen++] = '\0';
 		if (!(items[i].text = strdup(buf)))
-			die("cannot strdup %u bytes:", strlen(buf) + 1);
+			die("cannot strdup %u bytes:", len + 1);
+		itemlens[i] = len;
+		itemmasks[i] = mask;
 		items[i].out = 0;
-		if (strlen(items[i].text) > max)
-			max = strlen(maxstr = items[i].text);
+		if (len > max) {
+			max = len;
+			maxstr = items[i].text;
+		}
 	}
 	if (items)
 		items[i].text = NULL;
-	inputw = maxstr ? TEXTW(maxstr) : 0;
-	lines = MIN(lines, i);
+	nitems = i;
+	return NULL;
+}
+
+#ifdef XDAMAGE
+/* windows under the menu vanish at any time */
+static int
+livexerror(Display *dpy, XErrorEvent *ee)
+{
+	if (ee->error_code == BadWindow || ee->error_code == BadMatch
+	    || ee->error_code == BadDrawable
+	    || ee->error_code == damageerror + BadDamage)
+		return 0;
+	return xerrorxlib(dpy, ee);
+}
+
+/* Without a compositor windows do not keep their obscured contents, and
+ * the menu covers what it would have to capture again. */
+static int
+livecheck(void)
+{
+	char name[32];
+
+	if (!XDamageQueryExtension(dpy, &damageevent, &damageerror))
+		return 0;
+	snprintf(name, sizeof(name), "_NET_WM_CM_S%d", screen);
+	return XGetSelectionOwner(dpy, XInternAtom(dpy, name, False)) != None;
+}
+
+/* returns 0 if it misses the menu */
+static int
+livedirty(int x, int y, int w, int h)
+{
+	int x2, y2;
+
+	x2 = MIN(x + w, livex + mw);
+	y2 = MIN(y + h, livey + mh);
+	x = MAX(x, livex);
+	y = MAX(y, livey);
+	if (x >= x2 || y >= y2)
+		return 0;
+	if (dirty.width) {
+		x2 = MAX(x2, dirty.x + dirty.width);
+		y2 = MAX(y2, dirty.y + dirty.height);
+		x = MIN(x, dirty.x);
+		y = MIN(y, dirty.y);
+	}
+	dirty.x = x;
+	dirty.y = y;
+	dirty.width = x2 - x;
+	dirty.height = y2 - y;
+	return 1;
+}
+
+/* where a tracked window was, 0 if it is not tracked */
+static int
+liveunder(Window w)
+{
+	unsigned int i;
+
+	for (i = 0; i < nunder; i++)
+		if (under[i].win == w)
+			return livedirty(under[i].x, under[i].y, under[i].w, under[i].h);
+	return 0;
 }
 
+/* Damage every viewable window stacked under the menu that overlaps it.
+ * A compositor redirects them, so their contents can be read even where
+ * the menu covers them. */
 static void
-run(void)
+livetrack(void)
 {
-	XEvent ev;
+	Window dw, *wins = NULL;
+	XWindowAttributes wa;
+	unsigned int i, n;
 
-	while (!XNextEvent(dpy, &ev)) {
-		if (XFilterEvent(&ev, win))
+	for (i = 0; i < nunder; i++)
+		XDamageDestroy(dpy, under[i].damage);
+	nunder = 0;
+	if (!XQueryTree(dpy, root, &dw, &dw, &wins, &n))
+		return;
+	free(under);
+	under = ecalloc(n ? n : 1, sizeof(Under));
+	/* bottom to top, so later ones are painted over earlier ones */
+	for (i = 0; i < n && wins[i] != win; i++) {
+		if (!XGetWindowAttributes(dpy, wins[i], &wa) || wa.map_state != IsViewable
+		    || wa.class != InputOutput
+		    || wa.x + wa.border_width >= livex + mw || wa.y + wa.border_width >= livey + mh
+		    || wa.x + wa.border_width + wa.width <= livex
+		    || wa.y + wa.border_width + wa.height <= livey)
 			continue;
-		switch(ev.type) {
-		case ButtonPress:
-			buttonpress(&ev);
-			break;
-		case Expose:
-			if (ev.xexpose.count == 0)
-				drw_map(drw, win, 0, 0, mw, mh);
-			break;
-		case KeyPress:
-			keypress(&ev.xkey);
-			break;
-		case SelectionNotify:
-			if (ev.xselection.property == utf8)
-				paste();
-			break;
-		case VisibilityNotify:
-			if (ev.xvisibility.state != VisibilityUnobscured)
-				XRaiseWindow(dpy, win);
-			break;
+		under[nunder].win = wins[i];
+		under[nunder].x = wa.x + wa.border_width;
+		under[nunder].y = wa.y + wa.border_width;
+		under[nunder].w = wa.width;
+		under[nunder].h = wa.height;
+		under[nunder++].damage = XDamageCreate(dpy, wins[i], XDamageReportBoundingBox);
+	}
+	if (wins)
+		XFree(wins);
+}
+
+static void
+livestart(int x, int y)
+{
+	livex = x;
+	livey = y;
+	xerrorxlib = XSetErrorHandler(livexerror);
+	XSelectInput(dpy, root, SubstructureNotifyMask);
+	livetrack();
+	clock_gettime(CLOCK_MONOTONIC, &lastlive);
+}
+
+/* Changes to the stacking only mark where the window was and is; the
+ * windows are tracked again with the next update. */
+static int
+livehandle(XEvent *ev)
+{
+	XDamageNotifyEvent *de;
+	XConfigureEvent *ce;
+	XWindowAttributes wa;
+	unsigned int i;
+	int hit;
+
+	if (ev->type == damageevent + XDamageNotify) {
+		de = (XDamageNotifyEvent *)ev;
+		for (i = 0; i < nunder; i++)
+			if (under[i].damage == de->damage)
+				livedirty(under[i].x + de->area.x, under[i].y + de->area.y,
+				          de->area.width, de->area.height);
+		return 1;
+	}
+	if (ev->xany.window != root)
+		return 0;
+	switch (ev->type) {
+	case ConfigureNotify:
+		ce = &ev->xconfigure;
+		/* raising the menu is no change underneath */
+		if (ce->window == win)
+			return 1;
+		hit = liveunder(ce->window);
+		hit |= livedirty(ce->x + ce->border_width, ce->y + ce->border_width,
+		                 ce->width, ce->height);
+		break;
+	case MapNotify:
+		hit = XGetWindowAttributes(dpy, ev->xmap.window, &wa)
+		      && livedirty(wa.x + wa.border_width, wa.y + wa.border_width,
+		                   wa.width, wa.height);
+		break;
+	case UnmapNotify:
+		hit = liveunder(ev->xunmap.window);
+		break;
+	case DestroyNotify:
+		hit = liveunder(ev->xdestroywindow.window);
+		break;
+	case CirculateNotify:
+		hit = liveunder(ev->xcirculate.window);
+		break;
+	default:
+		return 0;
+	}
+	retrack |= hit;
+	return 1;
+}
+
+/* ms until the next update may run, -1 while nothing changed */
+static int
+livetimeout(void)
+{
+	struct timespec now;
+	long ms;
+
+	if (!dirty.width)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - lastlive.tv_sec) * 1000 + (now.tv_nsec - lastlive.tv_nsec) / 1000000;
+	return MAX(0, (long)live_blur_interval - ms);
+}
+
+/* Capture the changed part from the windows under the menu, on top of what
+ * was there before, and re-blur only what that reaches. */
+static void
+liveupdate(void)
+{
+	int x, y, x2, y2;
+	unsigned int i;
+
+	if (blurfd >= 0 || livetimeout())
+		return;
+	if (retrack) {
+		livetrack();
+		retrack = 0;
+	}
+	for (i = 0; i < nunder; i++)
+		XDamageSubtract(dpy, under[i].damage, None, None);
+	for (i = 0; i < nunder; i++) {
+		x = MAX(dirty.x, under[i].x);
+		y = MAX(dirty.y, under[i].y);
+		x2 = MIN(dirty.x + dirty.width, under[i].x + under[i].w);
+		y2 = MIN(dirty.y + dirty.height, under[i].y + under[i].h);
+		if (x < x2 && y < y2)
+			drw_screenshot_paint(drw, under[i].win, x - under[i].x, y - under[i].y,
+			                     x - livex, y - livey, x2 - x, y2 - y);
+	}
+	drw_screenshot_reblur(drw, dirty.x - livex, dirty.y - livey, dirty.width, dirty.height);
+	drw_load_tints(drw, scheme, SchemeLast, CPU_THREADS);
+	dirty.width = 0;
+	clock_gettime(CLOCK_MONOTONIC, &lastlive);
+	drawmenu();
+}
+#endif
+
+static void
+handle(XEvent *ev)
+{
+	if (XFilterEvent(ev, win))
+		return;
+#ifdef XDAMAGE
+	if (live && livehandle(ev))
+		return;
+#endif
+	switch(ev->type) {
+	case ButtonPress:
+		buttonpress(ev);
+		break;
+	case Expose:
+		if (ev->xexpose.count == 0)
+			drw_map(drw, win, 0, 0, mw, mh);
+		break;
+	case KeyPress:
+		keypress(&ev->xkey);
+		break;
+	case SelectionNotify:
+		if (ev->xselection.property == utf8)
+			paste();
+		break;
+	case VisibilityNotify:
+		if (ev->xvisibility.state != VisibilityUnobscured)
+			XRaiseWindow(dpy, win);
+		break;
+	}
+}
+
+static void
+run(void)
+{
+	XEvent ev;
+	struct pollfd fds[3];
+	int timeout;
+
+	fds[0].fd = ConnectionNumber(dpy);
+	fds[0].events = POLLIN;
+	fds[1].fd = blurfd;
+	fds[1].events = POLLIN;
+	fds[2].fd = matchfd[0];
+	fds[2].events = POLLIN;
+	timeout = -1;
+#ifdef XDAMAGE
+	while (blurfd >= 0 || matchfd[0] >= 0 || live) {
+#else
+	while (blurfd >= 0 || matchfd[0] >= 0) {
+#endif
+		/* XPending() also flushes what drawmenu() queued */
+		while (XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			handle(&ev);
+		}
+#ifdef XDAMAGE
+		if (live)
+			timeout = livetimeout();
+#endif
+		/* poll() skips fds[1] once it is -1 */
+		fds[1].fd = blurfd;
+		if (poll(fds, 3, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll:");
+		}
+		if (blurfd >= 0 && fds[1].revents) {
+			/* background is ready, swap it in */
+			drw_blur_finish(drw);
+			drw_load_tints(drw, scheme, SchemeLast, CPU_THREADS);
+			blurfd = -1;
+			drawmenu();
 		}
+		/* only the matches of the text as it is are drawn */
+		if (matchfd[0] >= 0 && fds[2].revents && matchread())
+			drawmenu();
+#ifdef XDAMAGE
+		if (live)
+			liveupdate();
+#endif
 	}
+	while (!XNextEvent(dpy, &ev))
+		handle(&ev);
 }
 
 static void
 setup(void)
 {
-	int x, y;
+	int x, y, dh;
 	XSetWindowAttributes swa;
 	XIM xim;
+	char *atomnames[] = { "CLIPBOARD", "UTF8_STRING" };
+	Atom atoms[LENGTH(atomnames)];
 #ifdef XINERAMA
 	XineramaScreenInfo *info;
 	Window w, pw, dw, *dws;
@@ -734,8 +1546,10 @@ setup(void)
 	scheme[SchemeOut].bg = drw_clr_create(drw, outbgcolor);
 	scheme[SchemeOut].fg = drw_clr_create(drw, outfgcolor);
 
-	clip = XInternAtom(dpy, "CLIPBOARD",   False);
-	utf8 = XInternAtom(dpy, "UTF8_STRING", False);
+	/* one round-trip for both */
+	XInternAtoms(dpy, atomnames, LENGTH(atomnames), False, atoms);
+	clip = atoms[0];
+	utf8 = atoms[1];
 
 	/* calculate menu geometry */
 	bh = drw->fonts[0]->h + 2;
@@ -777,12 +1591,35 @@ setup(void)
 		y = topbar ? 0 : sh - mh;
 		mw = sw;
 	}
+	/* The geometry above assumed stdin fills all the lines asked for, so
+	 * the capture and blur can overlap reading it; if fewer lines arrive
+	 * the menu shrinks to the part of the capture it still covers. */
+#ifdef XDAMAGE
+	if (live_blur && (live = livecheck()))
+		drw_screenshot_keep(drw, 1);
+#endif
+	drw_takescreenshot(drw, x, y, mw, mh);
+	blurfd = drw_blur_start(drw, blurlevel, blurquality, engine, CPU_THREADS);
+
+	if (readerrunning)
+		pthread_join(reader, NULL);
+	if (!fast)
+		grabkeyboard();
+	inputw = maxstr ? TEXTW(maxstr) : 0;
+	lines = MIN(lines, nitems);
+	if ((dh = mh - (int)(lines + 1) * bh) > 0) {
+		mh -= dh;
+		if (!topbar)
+			y += dh;
+		drw_screenshot_crop(drw, topbar ? 0 : dh, mh);
+	}
+
 	promptw = (prompt && *prompt) ? TEXTW(prompt) : 0;
 	inputw = MIN(inputw, mw/3);
 	fuzzymatch();
 	if (default_number)
 		for (i = 0; i < default_number; i++) {
-			if (!sel->right)
+			if (!sel->right && !rankrest())
 				break;
 			if (sel && (sel = sel->right) == next) {
 				printf("A\n");
@@ -796,7 +1633,12 @@ setup(void)
 	swa.background_pixel = scheme[SchemeNorm].bg->pix;
 	swa.event_mask = ExposureMask | KeyPressMask | VisibilityChangeMask |
 	                 ButtonPressMask;
-	drw_takesblurcreenshot(drw, x, y, mw, mh, blurlevel, CPU_THREADS);
+	/* without -a the first frame waits for the blurred background */
+	if (!async_blur && blurfd >= 0) {
+		drw_blur_finish(drw);
+		blurfd = -1;
+	}
+	drw_load_tints(drw, scheme, SchemeLast, CPU_THREADS);
 	win = XCreateWindow(dpy, root, x, y, mw, mh, 0,
 	                    DefaultDepth(dpy, screen), CopyFromParent,
 	                    DefaultVisual(dpy, screen),
@@ -807,9 +1649,11 @@ setup(void)
 	xic = XCreateIC(xim, XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
 	                XNClientWindow, win, XNFocusWindow, win, NULL);
 
-	//take the screenshot and blur it before displaying the menu window
-	
 	XMapRaised(dpy, win);
+#ifdef XDAMAGE
+	if (live)
+		livestart(x, y);
+#endif
 	drw_resize(drw, mw, mh);
 	drawmenu();
 }
@@ -819,14 +1663,15 @@ usage(void)
 {
 	fputs("usage: dmenu [-b] [-f] [-i] [-l lines] [-p prompt] [-fn font] [-m monitor]\n"
 	      "             [-nb color] [-nf color] [-sb color] [-sf color] [-v] [-n]\n"
-	      "             [-d default item number] [-k] [-r] [-s]\n", stderr);
+	      "             [-d default item number] [-k] [-r] [-s] [-a] [-bc] [-bl]\n"
+	      "             [-bq 1|2|4] [-be engine]\n", stderr);
 	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
-	int i, fast = 0;
+	int i;
 
 	for (i = 1; i < argc; i++)
 		/* these options take no arguments */
@@ -835,7 +1680,7 @@ main(int argc, char *argv[])
 			exit(0);
 		} else if (!strcmp(argv[i], "-b")) /* appears at the bottom of the screen */
 			topbar = 0;
-		else if (!strcmp(argv[i], "-f"))   /* grabs keyboard before reading stdin */
+		else if (!strcmp(argv[i], "-f"))   /* grabs keyboard while stdin is read */
 			fast = 1;
 		else if (!strcmp(argv[i], "-i")) { /* case-insensitive item matching */
 			fstrncmp = strncasecmp;
@@ -848,6 +1693,16 @@ main(int argc, char *argv[])
 			reverse_updown = 1;
 		else if (!strcmp(argv[i], "-s"))   /* Stay until Escape key pressed */
 			stay_after_select = 1;
+		else if (!strcmp(argv[i], "-a"))   /* map first, blur the background after */
+			async_blur = 1;
+		else if (!strcmp(argv[i], "-bc"))  /* reuse the blurred background of the last run */
+			blur_cache = 1;
+		else if (!strcmp(argv[i], "-bl"))  /* keep the blurred background up to date */
+#ifdef XDAMAGE
+			live_blur = 1;
+#else
+			die("dmenu: -bl needs Xdamage, see config.mk\n");
+#endif
 		else if (i + 1 == argc)
 			usage();
 		/* these options take one argument */
@@ -873,11 +1728,26 @@ main(int argc, char *argv[])
 			selfgcolor = argv[++i];
 		else if (!strcmp(argv[i], "-d")) /* Default selected item number */
 			default_number = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-bq")) { /* blur quality */
+			blurquality = atoi(argv[++i]);
+			if (blurquality != 1 && blurquality != 2 && blurquality != 4)
+				usage();
+		} else if (!strcmp(argv[i], "-be")) /* blur engine */
+			blurengine = argv[++i];
 		else
 			usage();
+	if ((engine = drw_blur_engine(blurengine)) < 0)
+		usage();
 
+	/* before the reader starts: it folds case in the locale of queries */
 	if (!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fputs("warning: no locale support\n", stderr);
+
+	/* stdin is read meanwhile, setup() waits for it once it needs the items */
+	if (pthread_create(&reader, NULL, readstdin, NULL))
+		readstdin(NULL);
+	else
+		readerrunning = 1;
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("cannot open display\n");
 	screen = DefaultScreen(dpy);
@@ -885,19 +1755,17 @@ main(int argc, char *argv[])
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	drw = drw_create(dpy, screen, root, sw, sh);
+	if (blur_cache)
+		drw_blur_cache(drw, getenv("XDG_RUNTIME_DIR"));
 	drw_load_fonts(drw, fonts, LENGTH(fonts));
 	if (!drw->fontcount)
 		die("no fonts could be loaded.\n");
 	drw_setscheme(drw, &scheme[SchemeNorm]);
 
-	if (fast) {
-		grabkeyboard();
-		readstdin();
-	} else {
-		readstdin();
+	if (fast)
 		grabkeyboard();
-	}
 	setup();
+	matchstart();
 	run();
 
 	return 1; /* unreachable */
@@ -1,13 +1,26 @@
 /* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
 
 #include "drw.h"
 #include "util.h"
+#include "boxblur.h"
+#include "iirblur.h"
 #include "stackblur.h"
+#include "stackconv.h"
+#include "stackscale.h"
 #include "stacktint.h"
 
 #define UTF_INVALID 0xFFFD
@@ -62,6 +75,134 @@ utf8decode(const char *c, long *u, size_t clen)
 	return len;
 }
 
+static int shmerror;
+
+static int
+drw_shm_xerror(Display *dpy, XErrorEvent *ee)
+{
+	shmerror = 1;
+	return 0;
+}
+
+/* MIT-SHM only works when the server can map our segments, so it is only
+ * tried for local connections and dropped on the first failed attach.
+ */
+static void
+drw_shm_init(Drw *drw)
+{
+	const char *name = DisplayString(drw->dpy);
+
+	if (name[0] != ':' && strncmp(name, "unix:", 5))
+		return;
+	drw->shm = XShmQueryExtension(drw->dpy);
+}
+
+static XImage *
+drw_shm_create(Drw *drw, XShmSegmentInfo *shminfo, unsigned int w, unsigned int h)
+{
+	XImage *image;
+	int (*xerrorxlib)(Display *, XErrorEvent *);
+
+	if (!drw->shm)
+		return NULL;
+	if (!(image = XShmCreateImage(drw->dpy, DefaultVisual(drw->dpy, drw->screen),
+	                              DefaultDepth(drw->dpy, drw->screen), ZPixmap,
+	                              NULL, shminfo, w, h)))
+		return NULL;
+	shminfo->shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * image->height,
+	                        IPC_CREAT | 0600);
+	if (shminfo->shmid == -1) {
+		XDestroyImage(image);
+		return NULL;
+	}
+	shminfo->shmaddr = image->data = shmat(shminfo->shmid, NULL, 0);
+	if (shminfo->shmaddr == (char *)-1) {
+		shmctl(shminfo->shmid, IPC_RMID, NULL);
+		shminfo->shmaddr = NULL;
+		XDestroyImage(image);
+		return NULL;
+	}
+	shminfo->readOnly = False;
+
+	shmerror = 0;
+	xerrorxlib = XSetErrorHandler(drw_shm_xerror);
+	XShmAttach(drw->dpy, shminfo);
+	XSync(drw->dpy, False);
+	XSetErrorHandler(xerrorxlib);
+	/* the segment goes away once both sides have detached */
+	shmctl(shminfo->shmid, IPC_RMID, NULL);
+	if (shmerror) {
+		drw->shm = 0;
+		shmdt(shminfo->shmaddr);
+		shminfo->shmaddr = NULL;
+		XDestroyImage(image);
+		return NULL;
+	}
+
+	return image;
+}
+
+static void
+drw_image_free(Display *dpy, XImage *image, XShmSegmentInfo *shminfo)
+{
+	if (shminfo->shmaddr) {
+		XShmDetach(dpy, shminfo);
+		shmdt(shminfo->shmaddr);
+		shminfo->shmaddr = NULL;
+	}
+	XDestroyImage(image);
+}
+
+static void
+drw_image_put(Drw *drw, Drawable d, XImage *image, XShmSegmentInfo *shminfo,
+              int x, int y, unsigned int w, unsigned int h)
+{
+	if (shminfo->shmaddr)
+		XShmPutImage(drw->dpy, d, drw->gc, image, x, y, x, y, w, h, False);
+	else
+		XPutImage(drw->dpy, d, drw->gc, image, x, y, x, y, w, h);
+}
+
+/* Fills are composited on the server when RENDER is available; the blurred
+ * screenshot is then uploaded once and only a few requests go out per frame.
+ */
+static void
+drw_render_init(Drw *drw)
+{
+	int event, error;
+
+	if (!XRenderQueryExtension(drw->dpy, &event, &error))
+		return;
+	if (!(drw->format = XRenderFindVisualFormat(drw->dpy, DefaultVisual(drw->dpy, drw->screen))))
+		return;
+	drw->picture = XRenderCreatePicture(drw->dpy, drw->drawable, drw->format, 0, NULL);
+}
+
+static void
+drw_render_freebg(Drw *drw)
+{
+	if (drw->bgpicture)
+		XRenderFreePicture(drw->dpy, drw->bgpicture);
+	if (drw->bgpixmap)
+		XFreePixmap(drw->dpy, drw->bgpixmap);
+	drw->bgpicture = None;
+	drw->bgpixmap = None;
+}
+
+static void
+drw_render_loadbg(Drw *drw)
+{
+	XImage *image = drw->screenshot;
+
+	drw_render_freebg(drw);
+	if (!drw->format || !image)
+		return;
+	drw->bgpixmap = XCreatePixmap(drw->dpy, drw->root, image->width, image->height,
+	                              DefaultDepth(drw->dpy, drw->screen));
+	drw_image_put(drw, drw->bgpixmap, image, &drw->shminfo, 0, 0, image->width, image->height);
+	drw->bgpicture = XRenderCreatePicture(drw->dpy, drw->bgpixmap, drw->format, 0, NULL);
+}
+
 Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
 {
@@ -77,6 +218,8 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	drw->fontcount = 0;
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
+	drw_shm_init(drw);
+	drw_render_init(drw);
 
 	return drw;
 }
@@ -86,9 +229,13 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 {
 	drw->w = w;
 	drw->h = h;
+	if (drw->picture)
+		XRenderFreePicture(drw->dpy, drw->picture);
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	if (drw->format)
+		drw->picture = XRenderCreatePicture(drw->dpy, drw->drawable, drw->format, 0, NULL);
 }
 
 void
@@ -96,8 +243,19 @@ drw_free(Drw *drw)
 {
 	size_t i;
 
+	/* the blur thread may still be writing to the screenshot */
+	if (drw->blur.running)
+		drw_blur_finish(drw);
 	for (i = 0; i < drw->fontcount; i++)
 		drw_font_free(drw->fonts[i]);
+	for (i = 0; i < drw->tintcount; i++)
+		drw_tint_free(drw->tints[i]);
+	if (drw->screenshot)
+		drw_image_free(drw->dpy, drw->screenshot, &drw->shminfo);
+	free(drw->raw);
+	drw_render_freebg(drw);
+	if (drw->picture)
+		XRenderFreePicture(drw->dpy, drw->picture);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	free(drw);
@@ -208,37 +366,226 @@ drw_setscheme(Drw *drw, ClrScheme *scheme)
 	drw->scheme = scheme;
 }
 
+static const struct {
+	const char *name;
+	void (*blur)(XImage *, int, int, int, int, int, unsigned int);
+} blurengines[BlurLast] = {
+	[BlurStack] = { "stack", stackblur },
+	[BlurBox]   = { "box",   boxblur },
+	[BlurIIR]   = { "iir",   iirblur },
+};
+
+int
+drw_blur_engine(const char *name)
+{
+	int i;
+
+	for (i = 0; i < BlurLast; i++)
+		if (!strcmp(blurengines[i].name, name))
+			return i;
+	return -1;
+}
+
+/* The kernels only take tight 32 bit images, see stackconv.h */
+static void
+drw_image_tight(XImage *image, XImage *work)
+{
+	*work = *image;
+	work->bits_per_pixel = 32;
+	work->depth = 24;
+	work->bytes_per_line = image->width * 4;
+	work->byte_order = LSBFirst;
+	work->red_mask = 0xff0000;
+	work->green_mask = 0xff00;
+	work->blue_mask = 0xff;
+	work->data = ecalloc(image->height, work->bytes_per_line);
+}
+
+/* With quality 2 or 4 the image is blurred at that fraction of its size with
+ * a scaled radius and stretched back, which is invisible once the radius is
+ * large enough; smaller radii fall back to finer qualities.
+ */
 void
-drw_bluriamge (XImage *image, int radius, unsigned int cpu_threads)
+drw_bluriamge (XImage *image, int radius, unsigned int quality, int engine, unsigned int cpu_threads)
+{
+	XImage small, work;
+
+	switch (stackconv_format(image)) {
+	case StackConvNative:
+		break;
+	case StackConvNone:
+		return;
+	default:
+		drw_image_tight(image, &work);
+		stackconv_unpack(image, &work, cpu_threads);
+		drw_bluriamge(&work, radius, quality, engine, cpu_threads);
+		stackconv_pack(&work, image, cpu_threads);
+		free(work.data);
+		return;
+	}
+	while (quality > 1 && (radius / (int)quality < DRW_BLUR_MINRADIUS
+	       || image->width < (int)quality || image->height < (int)quality))
+		quality /= 2;
+	if (quality <= 1) {
+		blurengines[engine].blur(image, 0, 0, image->width, image->height, radius, cpu_threads);
+		return;
+	}
+	small = *image;
+	small.width = (image->width + quality - 1) / quality;
+	small.height = (image->height + quality - 1) / quality;
+	small.bytes_per_line = small.width * 4;
+	small.data = ecalloc(small.height, small.bytes_per_line);
+	stackscale_down(image, &small, quality, cpu_threads);
+	blurengines[engine].blur(&small, 0, 0, small.width, small.height,
+	                         (radius + quality / 2) / quality, cpu_threads);
+	stackscale_up(&small, image, quality, cpu_threads);
+	free(small.data);
+}
+
+/* Blue, green and red of a pixel of the screen, 8 bits each whatever its
+ * format. */
+static void
+drw_pix_rgb(Drw *drw, unsigned long pix, unsigned char *t)
 {
-	stackblur(
-		image,
-		0,
-		0,
-		image->width,
-		image->height,
-		radius,
-		cpu_threads
-	);
+	Visual *visual = DefaultVisual(drw->dpy, drw->screen);
+	unsigned long mask[3] = { visual->blue_mask, visual->green_mask, visual->red_mask };
+	unsigned long c, max;
+	int i, shift;
+
+	for (i = 0; i < 3; i++) {
+		if (!mask[i]) {
+			t[i] = 0;
+			continue;
+		}
+		shift = __builtin_ctzl(mask[i]);
+		max = mask[i] >> shift;
+		c = (pix & mask[i]) >> shift;
+		t[i] = (c * 255 + max / 2) / max;
+	}
+}
+
+/* Copy of the blurred screenshot with the given pixel blended in, so fills
+ * only have to upload pixels instead of tinting the whole image each time.
+ */
+Tnt *
+drw_tint_create(Drw *drw, unsigned long pix, unsigned int num_threads)
+{
+	Tnt *tint;
+	XImage *image, work;
+	size_t size;
+	unsigned char t[3];
+
+	if (!drw->screenshot || stackconv_format(drw->screenshot) == StackConvNone)
+		return NULL;
+	tint = ecalloc(1, sizeof(Tnt));
+	size = (size_t)drw->screenshot->bytes_per_line * drw->screenshot->height;
+	if (!(image = drw_shm_create(drw, &tint->shminfo, drw->screenshot->width, drw->screenshot->height))
+	    || (size_t)image->bytes_per_line * image->height != size) {
+		if (image)
+			drw_image_free(drw->dpy, image, &tint->shminfo);
+		image = XCreateImage(drw->dpy, DefaultVisual(drw->dpy, drw->screen),
+		                     drw->screenshot->depth, ZPixmap, 0, NULL,
+		                     drw->screenshot->width, drw->screenshot->height,
+		                     drw->screenshot->bitmap_pad, drw->screenshot->bytes_per_line);
+		if (!(image->data = malloc(size)))
+			die("cannot malloc %u bytes:", size);
+	}
+	drw_pix_rgb(drw, pix, t);
+	if (stackconv_format(image) == StackConvNative) {
+		memcpy(image->data, drw->screenshot->data, size);
+		stacktint(image, t, num_threads);
+	} else {
+		drw_image_tight(drw->screenshot, &work);
+		stackconv_unpack(drw->screenshot, &work, num_threads);
+		stacktint(&work, t, num_threads);
+		stackconv_pack(&work, image, num_threads);
+		free(work.data);
+	}
+
+	tint->dpy = drw->dpy;
+	tint->pix = pix;
+	tint->image = image;
+
+	return tint;
+}
+
+void
+drw_load_tints(Drw *drw, ClrScheme *schemes, size_t schemecount, unsigned int num_threads)
+{
+	size_t i, j;
+	Tnt *tint;
+
+	if (drw->bgpicture || drw->blur.running)
+		return;
+	for (i = 0; i < schemecount; i++) {
+		for (j = 0; j < drw->tintcount; j++)
+			if (drw->tints[j]->pix == schemes[i].bg->pix)
+				break;
+		if (j < drw->tintcount || drw->tintcount >= DRW_TINT_CACHE_SIZE)
+			continue;
+		if ((tint = drw_tint_create(drw, schemes[i].bg->pix, num_threads)))
+			drw->tints[drw->tintcount++] = tint;
+	}
 }
 
 void
-drw_fillrect(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned long tint, unsigned int num_threads)
-{
-	XImage *image = malloc(sizeof(XImage));
-    memcpy(image,drw->screenshot,sizeof(XImage));
-    unsigned long bytes2copy=sizeof(char)*drw->screenshot->bytes_per_line*drw->screenshot->height;
-    image->data=malloc(bytes2copy);
-    memcpy(image->data,drw->screenshot->data,bytes2copy);
-    unsigned char *t = malloc(3 * sizeof(char));
-    t[0] = tint & 0xff;
-    t[1] = (tint >> 8) & 0xff;
-    t[2] = (tint >> 16) & 0xff;
-    stacktint(image, t, num_threads);
-    
-    XPutImage(drw->dpy, drw->drawable, drw->gc, image, x, y, x, y, w, h);
-    XFlush(drw->dpy);
-    free(image);
+drw_tint_free(Tnt *tint)
+{
+	if (!tint)
+		return;
+	drw_image_free(tint->dpy, tint->image, &tint->shminfo);
+	free(tint);
+}
+
+void
+drw_fillrect(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned long pix, unsigned int num_threads)
+{
+	Tnt *tint = NULL;
+	XRenderColor color;
+	unsigned char t[3];
+	size_t i;
+
+	if (drw->blur.running) {
+		/* the background is still being blurred */
+		XSetForeground(drw->dpy, drw->gc, pix);
+		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+		return;
+	}
+	if (drw->bgpicture) {
+		/* blurred background, then the colour blended over it at 50% */
+		drw_pix_rgb(drw, pix, t);
+		color.red = t[2] * 0x101 / 2;
+		color.green = t[1] * 0x101 / 2;
+		color.blue = t[0] * 0x101 / 2;
+		color.alpha = 0x8000;
+		XRenderComposite(drw->dpy, PictOpSrc, drw->bgpicture, None, drw->picture,
+		                 x, y, 0, 0, x, y, w, h);
+		XRenderFillRectangle(drw->dpy, PictOpOver, drw->picture, &color, x, y, w, h);
+		return;
+	}
+	for (i = 0; i < drw->tintcount; i++)
+		if (drw->tints[i]->pix == pix) {
+			tint = drw->tints[i];
+			break;
+		}
+	/* colours not preloaded (e.g. the cursor) are cached on first use */
+	if (!tint && (tint = drw_tint_create(drw, pix, num_threads))) {
+		if (drw->tintcount < DRW_TINT_CACHE_SIZE) {
+			drw->tints[drw->tintcount++] = tint;
+		} else {
+			drw_image_put(drw, drw->drawable, tint->image, &tint->shminfo, x, y, w, h);
+			XSync(drw->dpy, False);
+			drw_tint_free(tint);
+			return;
+		}
+	}
+	if (!tint) {
+		/* no screenshot in a format the tint can handle */
+		XSetForeground(drw->dpy, drw->gc, pix);
+		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+		return;
+	}
+	drw_image_put(drw, drw->drawable, tint->image, &tint->shminfo, x, y, w, h);
 }
 
 void
@@ -257,10 +604,316 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 }
 
 void
-drw_takesblurcreenshot(Drw *drw, int x, int y, unsigned int w, unsigned int h, int blurlevel, unsigned int num_threads)
+drw_takescreenshot(Drw *drw, int x, int y, unsigned int w, unsigned int h)
+{
+	size_t i;
+
+	if (drw->blur.running)
+		drw_blur_finish(drw);
+	/* tinted copies of a previous screenshot are stale now */
+	for (i = 0; i < drw->tintcount; i++)
+		drw_tint_free(drw->tints[i]);
+	drw->tintcount = 0;
+	drw_render_freebg(drw);
+	if (drw->screenshot)
+		drw_image_free(drw->dpy, drw->screenshot, &drw->shminfo);
+	if ((drw->screenshot = drw_shm_create(drw, &drw->shminfo, w, h))
+	    && !XShmGetImage(drw->dpy, drw->root, drw->screenshot, x, y, AllPlanes)) {
+		drw_image_free(drw->dpy, drw->screenshot, &drw->shminfo);
+		drw->screenshot = NULL;
+	}
+	if (!drw->screenshot)
+		drw->screenshot = XGetImage(drw->dpy,drw->root, x, y, w, h, AllPlanes, ZPixmap);
+	free(drw->raw);
+	drw->raw = NULL;
+	if (drw->keepraw && drw->screenshot) {
+		i = (size_t)drw->screenshot->bytes_per_line * drw->screenshot->height;
+		drw->raw = ecalloc(1, i);
+		memcpy(drw->raw, drw->screenshot->data, i);
+	}
+}
+
+/* Keep an unblurred copy of the next screenshots, for drw_screenshot_paint()
+ * and drw_screenshot_reblur(). */
+void
+drw_screenshot_keep(Drw *drw, int keep)
+{
+	drw->keepraw = keep;
+}
+
+/* Copy the w x h pixels at dx, dy of d over x, y of the unblurred screenshot.
+ * d going away meanwhile is left to the caller's error handler, the copy is
+ * skipped then. */
+void
+drw_screenshot_paint(Drw *drw, Drawable d, int dx, int dy, int x, int y, unsigned int w, unsigned int h)
+{
+	XImage *image = drw->screenshot, *part;
+	unsigned int i, bpp;
+
+	if (!drw->raw || stackconv_format(image) == StackConvNone || x < 0 || y < 0
+	    || x + w > (unsigned int)image->width || y + h > (unsigned int)image->height)
+		return;
+	if (!(part = XGetImage(drw->dpy, d, dx, dy, w, h, AllPlanes, ZPixmap)))
+		return;
+	bpp = image->bits_per_pixel / 8;
+	if (part->bits_per_pixel == image->bits_per_pixel)
+		for (i = 0; i < h; i++)
+			memcpy(drw->raw + (size_t)(y + i) * image->bytes_per_line + x * bpp,
+			       part->data + (size_t)i * part->bytes_per_line, w * bpp);
+	XDestroyImage(part);
+}
+
+/* Blur again what changes once rect x, y, w, h of the unblurred screenshot
+ * has: the rect and the reach of the blur around it, blurred from as far
+ * further out.  Only that part is uploaded again. */
+void
+drw_screenshot_reblur(Drw *drw, int x, int y, unsigned int w, unsigned int h)
+{
+	XImage *image = drw->screenshot, part;
+	int q = drw->blur.quality, r, ex, ey, ex2, ey2, ix, iy, ix2, iy2, i;
+	int bpp = image->bits_per_pixel / 8;
+	size_t j;
+
+	if (!drw->raw || drw->blur.running || stackconv_format(image) == StackConvNone)
+		return;
+	/* the stack blur reaches a radius, the box blurs' radii add up to
+	 * more and the recursive one fades out within about as far; with a
+	 * downsampled blur the scaling reaches a block or two further */
+	r = (drw->blur.engine == BlurStack ? 1 : 2) * drw->blur.radius + 2 * q;
+	ex = MAX(0, x - r);
+	ey = MAX(0, y - r);
+	ex2 = MIN(image->width, x + (int)w + r);
+	ey2 = MIN(image->height, y + (int)h + r);
+	if (ex >= ex2 || ey >= ey2)
+		return;
+	/* the blocks have to line up with the full blur's */
+	ix = MAX(0, ex - r) / q * q;
+	iy = MAX(0, ey - r) / q * q;
+	ix2 = MIN(image->width, ex2 + r);
+	iy2 = MIN(image->height, ey2 + r);
+	part = *image;
+	part.width = ix2 - ix;
+	part.height = iy2 - iy;
+	part.bytes_per_line = part.width * bpp;
+	part.data = ecalloc(part.height, part.bytes_per_line);
+	for (i = 0; i < part.height; i++)
+		memcpy(part.data + (size_t)i * part.bytes_per_line,
+		       drw->raw + (size_t)(iy + i) * image->bytes_per_line + ix * bpp,
+		       part.bytes_per_line);
+	drw_bluriamge(&part, drw->blur.radius, q, drw->blur.engine, drw->blur.threads);
+	for (i = ey; i < ey2; i++)
+		memcpy(image->data + (size_t)i * image->bytes_per_line + ex * bpp,
+		       part.data + (size_t)(i - iy) * part.bytes_per_line + (ex - ix) * bpp,
+		       (ex2 - ex) * bpp);
+	free(part.data);
+	for (j = 0; j < drw->tintcount; j++)
+		drw_tint_free(drw->tints[j]);
+	drw->tintcount = 0;
+	if (drw->bgpixmap)
+		drw_image_put(drw, drw->bgpixmap, image, &drw->shminfo, ex, ey, ex2 - ex, ey2 - ey);
+}
+
+void
+drw_takesblurcreenshot(Drw *drw, int x, int y, unsigned int w, unsigned int h, int blurlevel, unsigned int blurquality, int blurengine, unsigned int num_threads)
+{
+	drw_takescreenshot(drw, x, y, w, h);
+	if (drw->screenshot)
+		drw_bluriamge(drw->screenshot, blurlevel, blurquality, blurengine, num_threads);
+	drw_render_loadbg(drw);
+}
+
+/* Chained menus keep blurring the same piece of screen, so the last result
+ * is kept in a file together with what it was made from.  Another process's
+ * damage tracking cannot be inherited, so the capture is still taken and the
+ * key holds a hash of it; a hit only saves the blur.
+ */
+typedef struct {
+	char magic[8];
+	int width, height, bpl, bpp;
+	int radius, quality, engine;
+	unsigned long long hash;
+} BlurKey;
+
+static unsigned long long
+drw_blur_hash(const unsigned char *p, size_t n)
+{
+	unsigned long long h = 0x9e3779b97f4a7c15ULL, v;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		memcpy(&v, p + i, 8);
+		h = (h ^ v) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for (; i < n; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static void
+drw_blur_cachepath(Drw *drw, char *path, size_t size)
+{
+	snprintf(path, size, "%s/dmenu-blur-%dx%d", drw->blur.cachedir,
+	         drw->screenshot->width, drw->screenshot->height);
+}
+
+static int
+drw_blur_load(Drw *drw, BlurKey *key, size_t size)
+{
+	char path[4096];
+	BlurKey k;
+	struct stat st;
+	int fd, ok = 0;
+
+	drw_blur_cachepath(drw, path, sizeof(path));
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	/* the file is written whole and renamed in place, but the size is
+	 * checked before reading over the capture */
+	if (!fstat(fd, &st) && (size_t)st.st_size == sizeof(k) + size
+	    && read(fd, &k, sizeof(k)) == sizeof(k) && !memcmp(&k, key, sizeof(k)))
+		ok = read(fd, drw->screenshot->data, size) == (ssize_t)size;
+	close(fd);
+	return ok;
+}
+
+static void
+drw_blur_store(Drw *drw, BlurKey *key, size_t size)
+{
+	char path[4096], tmp[4096 + 16];
+	int fd, ok;
+
+	drw_blur_cachepath(drw, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+		return;
+	ok = write(fd, key, sizeof(*key)) == sizeof(*key)
+	     && write(fd, drw->screenshot->data, size) == (ssize_t)size;
+	if (close(fd) < 0 || !ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+static void
+drw_blur_run(Drw *drw)
+{
+	XImage *image = drw->screenshot;
+	size_t size = (size_t)image->bytes_per_line * image->height;
+	BlurKey key;
+
+	if (!drw->blur.cachedir) {
+		drw_bluriamge(image, drw->blur.radius, drw->blur.quality,
+		              drw->blur.engine, drw->blur.threads);
+		return;
+	}
+	memset(&key, 0, sizeof(key));
+	memcpy(key.magic, "dmenubl1", 8);
+	key.width = image->width;
+	key.height = image->height;
+	key.bpl = image->bytes_per_line;
+	key.bpp = image->bits_per_pixel;
+	key.radius = drw->blur.radius;
+	key.quality = drw->blur.quality;
+	key.engine = drw->blur.engine;
+	key.hash = drw_blur_hash((unsigned char *)image->data, size);
+	if (drw_blur_load(drw, &key, size))
+		return;
+	drw_bluriamge(image, drw->blur.radius, drw->blur.quality,
+	              drw->blur.engine, drw->blur.threads);
+	drw_blur_store(drw, &key, size);
+}
+
+/* Only touches the screenshot's pixels and the cache file, no Xlib calls, so
+ * the main thread can keep talking to the server meanwhile. */
+static void *
+drw_blur_thread(void *arg)
+{
+	Drw *drw = arg;
+
+	drw_blur_run(drw);
+	while (write(drw->blur.pipe[1], "", 1) < 0 && errno == EINTR)
+		;
+	return NULL;
+}
+
+/* Blur the screenshot on a thread of its own.  Returns a descriptor that
+ * becomes readable when it is done, drw_blur_finish() must be called then;
+ * until that drw_fillrect() paints flat colours.  Returns -1 when the blur
+ * could not be started and has already been done synchronously. */
+int
+drw_blur_start(Drw *drw, int blurlevel, unsigned int blurquality, int blurengine, unsigned int num_threads)
+{
+	if (!drw->screenshot || drw->blur.running)
+		return -1;
+	drw->blur.radius = blurlevel;
+	drw->blur.quality = blurquality;
+	drw->blur.engine = blurengine;
+	drw->blur.threads = num_threads;
+	if (pipe(drw->blur.pipe) < 0) {
+		drw_blur_run(drw);
+		drw_render_loadbg(drw);
+		return -1;
+	}
+	if (pthread_create(&drw->blur.thread, NULL, drw_blur_thread, drw)) {
+		close(drw->blur.pipe[0]);
+		close(drw->blur.pipe[1]);
+		drw_blur_run(drw);
+		drw_render_loadbg(drw);
+		return -1;
+	}
+	drw->blur.running = 1;
+	return drw->blur.pipe[0];
+}
+
+/* Blurred screenshots are looked up in and saved to dir from now on, no
+ * caching when it is NULL. */
+void
+drw_blur_cache(Drw *drw, const char *dir)
+{
+	drw->blur.cachedir = dir && *dir ? dir : NULL;
+}
+
+void
+drw_blur_finish(Drw *drw)
 {
-    drw->screenshot = XGetImage(drw->dpy,drw->root, x, y, w, h, AllPlanes, ZPixmap);
-    drw_bluriamge(drw->screenshot, blurlevel, num_threads);
+	if (!drw->blur.running)
+		return;
+	pthread_join(drw->blur.thread, NULL);
+	close(drw->blur.pipe[0]);
+	close(drw->blur.pipe[1]);
+	drw->blur.running = 0;
+	if (drw->blur.croph) {
+		drw_screenshot_crop(drw, drw->blur.cropy, drw->blur.croph);
+		drw->blur.croph = 0;
+	}
+	drw_render_loadbg(drw);
+}
+
+/* Keep only rows y to y + h of the screenshot; while it is still being
+ * blurred that is left to drw_blur_finish(). */
+void
+drw_screenshot_crop(Drw *drw, int y, unsigned int h)
+{
+	XImage *image = drw->screenshot;
+	size_t i;
+
+	if (drw->blur.running) {
+		drw->blur.cropy = y;
+		drw->blur.croph = h;
+		return;
+	}
+	if (!image || y < 0 || y + h > (unsigned int)image->height)
+		return;
+	memmove(image->data, image->data + (size_t)y * image->bytes_per_line,
+	        (size_t)h * image->bytes_per_line);
+	if (drw->raw)
+		memmove(drw->raw, drw->raw + (size_t)y * image->bytes_per_line,
+		        (size_t)h * image->bytes_per_line);
+	image->height = h;
+	for (i = 0; i < drw->tintcount; i++)
+		drw_tint_free(drw->tints[i]);
+	drw->tintcount = 0;
+	if (drw->bgpicture)
+		drw_render_loadbg(drw);
 }
 
 int
@@ -1,5 +1,10 @@
 /* See LICENSE file for copyright and license details. */
 #define DRW_FONT_CACHE_SIZE 32
+#define DRW_TINT_CACHE_SIZE 8
+/* smallest radius drw_bluriamge() blurs a downsampled image with */
+#define DRW_BLUR_MINRADIUS 4
+
+enum { BlurStack, BlurBox, BlurIIR, BlurLast }; /* blur engines */
 
 typedef struct {
 	unsigned long pix;
@@ -19,6 +24,27 @@ typedef struct {
 	FcPattern *pattern;
 } Fnt;
 
+typedef struct {
+	Display *dpy;
+	unsigned long pix;
+	XImage *image;
+	XShmSegmentInfo shminfo;
+} Tnt;
+
+/* blur running on its own thread, see drw_blur_start() */
+typedef struct {
+	pthread_t thread;
+	int pipe[2];
+	int running;
+	int radius;
+	unsigned int quality;
+	int engine;
+	unsigned int threads;
+	int cropy; /* drw_screenshot_crop() to do once the blur is done */
+	unsigned int croph;
+	const char *cachedir; /* where blurred screenshots are kept, or NULL */
+} Blr;
+
 typedef struct {
 	Clr *fg;
 	Clr *bg;
@@ -32,11 +58,22 @@ typedef struct {
 	Window root;
 	Drawable drawable;
 	GC gc;
+	XRenderPictFormat *format;
+	Picture picture;
+	Picture bgpicture;
+	Pixmap bgpixmap;
 	ClrScheme *scheme0;
 	ClrScheme *scheme;
 	size_t fontcount;
 	Fnt *fonts[DRW_FONT_CACHE_SIZE];
 	XImage *screenshot;
+	int keepraw;
+	char *raw; /* screenshot before the blur, see drw_screenshot_keep() */
+	int shm;
+	XShmSegmentInfo shminfo;
+	Blr blur;
+	size_t tintcount;
+	Tnt *tints[DRW_TINT_CACHE_SIZE];
 } Drw;
 
 typedef struct {
@@ -44,14 +81,23 @@ typedef struct {
 	unsigned int h;
 } Extnts;
 
-void drw_bluriamge (XImage *image, int radius, unsigned int cpu_threads);
+int drw_blur_engine(const char *name);
+void drw_bluriamge (XImage *image, int radius, unsigned int quality, int engine, unsigned int cpu_threads);
 void drw_blurrect(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned long tint, unsigned int num_threads);
 
 /* Drawable abstraction */
 Drw *drw_create(Display *, int, Window, unsigned int, unsigned int);
 void drw_resize(Drw *, unsigned int, unsigned int);
 void drw_free(Drw *);
-void drw_takesblurcreenshot(Drw *drw, int x, int y, unsigned int w, unsigned int h, int blurlevel, unsigned int num_threads);
+void drw_takescreenshot(Drw *drw, int x, int y, unsigned int w, unsigned int h);
+void drw_takesblurcreenshot(Drw *drw, int x, int y, unsigned int w, unsigned int h, int blurlevel, unsigned int blurquality, int blurengine, unsigned int num_threads);
+int drw_blur_start(Drw *drw, int blurlevel, unsigned int blurquality, int blurengine, unsigned int num_threads);
+void drw_blur_finish(Drw *drw);
+void drw_blur_cache(Drw *drw, const char *dir);
+void drw_screenshot_crop(Drw *drw, int y, unsigned int h);
+void drw_screenshot_keep(Drw *drw, int keep);
+void drw_screenshot_paint(Drw *drw, Drawable d, int dx, int dy, int x, int y, unsigned int w, unsigned int h);
+void drw_screenshot_reblur(Drw *drw, int x, int y, unsigned int w, unsigned int h);
 
 /* Fnt abstraction */
 Fnt *drw_font_create(Drw *, const char *);
@@ -60,6 +106,11 @@ void drw_font_free(Fnt *);
 void drw_font_getexts(Fnt *, const char *, unsigned int, Extnts *);
 unsigned int drw_font_getexts_width(Fnt *, const char *, unsigned int);
 
+/* Tint abstraction */
+Tnt *drw_tint_create(Drw *, unsigned long, unsigned int);
+void drw_load_tints(Drw *, ClrScheme *, size_t, unsigned int);
+void drw_tint_free(Tnt *);
+
 /* Colour abstraction */
 Clr *drw_clr_create(Drw *, const char *);
 void drw_clr_free(Clr *);
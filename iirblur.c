@@ -0,0 +1,149 @@
+#include "iirblur.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+//Filters a line of n pixels, stride pixels apart, in place. buf holds the
+//forward result. Both directions start as if the edge pixel went on
+//forever, like the stack blur's edges.
+static void iirline(unsigned char *pix, int stride, int n, const float *b, float *buf) {
+	float r1,r2,r3,g1,g2,g3,b1,b2,b3,v;
+	unsigned char *p=pix;
+	float *f=buf;
+	int i;
+	stride*=4;
+	r1=r2=r3=p[2];
+	g1=g2=g3=p[1];
+	b1=b2=b3=p[0];
+	for (i=0;i<n;i++) {
+		v=b[0]*p[2]+b[1]*r1+b[2]*r2+b[3]*r3;
+		r3=r2;
+		r2=r1;
+		f[2]=r1=v;
+		v=b[0]*p[1]+b[1]*g1+b[2]*g2+b[3]*g3;
+		g3=g2;
+		g2=g1;
+		f[1]=g1=v;
+		v=b[0]*p[0]+b[1]*b1+b[2]*b2+b[3]*b3;
+		b3=b2;
+		b2=b1;
+		f[0]=b1=v;
+		p+=stride;
+		f+=3;
+	}
+	r2=r3=r1;
+	g2=g3=g1;
+	b2=b3=b1;
+	for (i=n-1;i>=0;i--) {
+		p-=stride;
+		f-=3;
+		v=b[0]*f[2]+b[1]*r1+b[2]*r2+b[3]*r3;
+		r3=r2;
+		r2=r1;
+		r1=v;
+		v=b[0]*f[1]+b[1]*g1+b[2]*g2+b[3]*g3;
+		g3=g2;
+		g2=g1;
+		g1=v;
+		v=b[0]*f[0]+b[1]*b1+b[2]*b2+b[3]*b3;
+		b3=b2;
+		b2=b1;
+		b1=v;
+		p[0]=(unsigned char)MIN(255.0f,MAX(0.0f,b1+0.5f));
+		p[1]=(unsigned char)MIN(255.0f,MAX(0.0f,g1+0.5f));
+		p[2]=(unsigned char)MIN(255.0f,MAX(0.0f,r1+0.5f));
+		p[3]=0xff;
+	}
+}
+
+void *HIIRRenderingThread(void *arg) {
+	IIRBlurRenderingParams *rp=(IIRBlurRenderingParams*)arg;
+	int y,n=rp->x2-rp->x;
+	float *buf=malloc(n*3*sizeof(float));
+	for (y=rp->y;y<rp->y2;y++)
+		iirline(rp->pix+(y*rp->stride+rp->x)*4,1,n,rp->b,buf);
+	free(buf);
+	return NULL;
+}
+
+//Neighbouring columns share cache lines, so they are walked a strip at a
+//time while the strip's lines are still cached
+void *VIIRRenderingThread(void *arg) {
+	IIRBlurRenderingParams *rp=(IIRBlurRenderingParams*)arg;
+	int x,c,n=rp->y2-rp->y;
+	float *buf=malloc(n*3*sizeof(float));
+	for (x=rp->x;x<rp->x2;x+=IIRBLUR_STRIP)
+		for (c=x;c<MIN(x+IIRBLUR_STRIP,rp->x2);c++)
+			iirline(rp->pix+(rp->y*rp->stride+c)*4,rp->stride,n,rp->b,buf);
+	free(buf);
+	return NULL;
+}
+
+//Young and van Vliet's coefficients for the sigma matching a stack blur of radius
+static void iircoefs(int radius, float *b) {
+	double s=sqrt(radius*(radius+2)/6.0);
+	double q=s>=2.5?0.98711*s-0.96330:3.97156-4.14554*sqrt(1-0.26891*s);
+	double b0=1.57825+2.44413*q+1.4281*q*q+0.422205*q*q*q;
+	b[1]=(2.44413*q+2.85619*q*q+1.26661*q*q*q)/b0;
+	b[2]=-(1.4281*q*q+1.26661*q*q*q)/b0;
+	b[3]=0.422205*q*q*q/b0;
+	b[0]=1-(b[1]+b[2]+b[3]);
+}
+
+void iirblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads) {
+	if (radius<1)
+		return;
+	int i;
+	float b[4];
+	iircoefs(radius,b);
+
+	PoolGroup group={0};
+	pool_init(num_threads);
+	//Row tiles then column tiles, see stackblur()
+	int tiles=num_threads*IIRBLUR_TILES_PER_THREAD;
+	int tileH=MAX(1,(h+tiles-1)/tiles);
+	int tileW=MAX(1,(w+tiles-1)/tiles);
+	tileW=(tileW+IIRBLUR_STRIP-1)/IIRBLUR_STRIP*IIRBLUR_STRIP;
+	int nh=(h+tileH-1)/tileH;
+	int nv=(w+tileW-1)/tileW;
+	IIRBlurRenderingParams *rp=malloc((nh+nv)*sizeof(IIRBlurRenderingParams));
+	for (i=0;i<nh+nv;i++) {
+		rp[i].pix=(unsigned char*)image->data;
+		rp[i].stride=image->bytes_per_line/4;
+		if (i<nh) {
+			rp[i].x=x;
+			rp[i].x2=x+w;
+			rp[i].y=y+i*tileH;
+			rp[i].y2=MIN(rp[i].y+tileH,y+h);
+		} else {
+			rp[i].x=x+(i-nh)*tileW;
+			rp[i].x2=MIN(rp[i].x+tileW,x+w);
+			rp[i].y=y;
+			rp[i].y2=y+h;
+		}
+		rp[i].b[0]=b[0];
+		rp[i].b[1]=b[1];
+		rp[i].b[2]=b[2];
+		rp[i].b[3]=b[3];
+	}
+#ifdef DEBUG
+	fprintf(stdout,"IIR B: %f b1: %f b2: %f b3: %f\n",b[0],b[1],b[2],b[3]);
+#endif
+	for (i=0;i<nh;i++)
+		pool_submit(&group,HIIRRenderingThread,(void*)&rp[i]);
+	pool_wait(&group);
+	for (i=nh;i<nh+nv;i++)
+		pool_submit(&group,VIIRRenderingThread,(void*)&rp[i]);
+	pool_wait(&group);
+#ifdef DEBUG
+	pool_dumpstats(stdout,"iirblur");
+#endif
+	free(rp);
+	rp=NULL;
+}
+#undef MIN
+#undef MAX
@@ -0,0 +1,33 @@
+//#define DEBUG
+
+// Recursive Gaussian blur
+//
+// I.T. Young, L.J. van Vliet, "Recursive implementation of the Gaussian
+// filter", Signal Processing 44 (1995). Every line is filtered by a third
+// order recursion forwards and then backwards, a handful of multiplies per
+// pixel and channel no matter how large sigma is. Sigma is taken from the
+// variance of the stack blur of the same radius.
+
+#include <X11/Xlib.h>
+
+//Tiles queued per worker and pass, like stackblur()
+#define IIRBLUR_TILES_PER_THREAD 8
+//Columns the vertical pass walks together
+#define IIRBLUR_STRIP 16
+
+typedef struct {
+	unsigned char *pix;
+	int x;
+	int x2;
+	int y;
+	int y2;
+	int stride;
+	//B and b1..b3 already divided by b0
+	float b[4];
+} IIRBlurRenderingParams;
+
+void *HIIRRenderingThread(void *arg);
+
+void *VIIRRenderingThread(void *arg);
+
+void iirblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads);
@@ -0,0 +1,237 @@
+/* See LICENSE file for copyright and license details. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pool.h"
+#include "util.h"
+
+typedef struct {
+	void *(*func)(void *);
+	void *arg;
+	PoolGroup *group;
+} Task;
+
+/* Each worker owns a deque: it takes its own work from the bottom and
+ * idle workers steal from the top of somebody else's. */
+typedef struct {
+	Task *tasks;
+	size_t top, bottom, cap;
+	unsigned long ran, stolen;
+	unsigned long long busy; /* ns */
+} Deque;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static pthread_t *workers;
+static unsigned int nworkers;
+static Deque *deques; /* nworkers + 1, the last one counts waiting callers */
+static unsigned int nextdeque;
+static int quit;
+
+static unsigned long long
+pool_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+pool_push(Deque *d, Task *t)
+{
+	if (d->bottom == d->cap) {
+		d->cap = d->cap ? d->cap * 2 : 64;
+		if (!(d->tasks = realloc(d->tasks, d->cap * sizeof(Task))))
+			die("cannot realloc %u bytes:", d->cap * sizeof(Task));
+	}
+	d->tasks[d->bottom++] = *t;
+}
+
+/* take a task of the given group (any if NULL) from the top or bottom
+ * of a deque; called with lock held */
+static int
+pool_take(Deque *d, PoolGroup *group, int bottom, Task *t)
+{
+	size_t i;
+
+	if (d->top == d->bottom)
+		return 0;
+	if (bottom && !group) {
+		*t = d->tasks[--d->bottom];
+	} else {
+		for (i = d->top; i < d->bottom; i++)
+			if (!group || d->tasks[i].group == group)
+				break;
+		if (i == d->bottom)
+			return 0;
+		*t = d->tasks[i];
+		d->tasks[i] = d->tasks[d->top++];
+	}
+	if (d->top == d->bottom)
+		d->top = d->bottom = 0;
+	return 1;
+}
+
+/* called with lock held */
+static int
+pool_steal(unsigned int self, PoolGroup *group, Task *t)
+{
+	unsigned int i;
+
+	for (i = 1; i <= nworkers; i++)
+		if (pool_take(&deques[(self + i) % nworkers], group, 0, t))
+			return 1;
+	return 0;
+}
+
+/* called with lock held, drops it while the task runs */
+static void
+pool_run(Deque *d, Task *t, int stolen)
+{
+	unsigned long long start;
+
+	pthread_mutex_unlock(&lock);
+	start = pool_now();
+	t->func(t->arg);
+	start = pool_now() - start;
+	pthread_mutex_lock(&lock);
+	d->ran++;
+	d->stolen += stolen;
+	d->busy += start;
+	if (!--t->group->pending)
+		pthread_cond_broadcast(&done);
+}
+
+static void *
+pool_worker(void *arg)
+{
+	unsigned int self = (unsigned int)(size_t)arg;
+	Task t;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		if (pool_take(&deques[self], NULL, 1, &t))
+			pool_run(&deques[self], &t, 0);
+		else if (pool_steal(self, NULL, &t))
+			pool_run(&deques[self], &t, 1);
+		else if (quit)
+			break;
+		else
+			pthread_cond_wait(&work, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* Start the process-wide workers; only the first call has an effect. */
+void
+pool_init(unsigned int num_threads)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&lock);
+	if (workers || !num_threads) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	workers = ecalloc(num_threads, sizeof(pthread_t));
+	deques = ecalloc(num_threads + 1, sizeof(Deque));
+	nworkers = num_threads;
+	for (i = 0; i < num_threads; i++)
+		if (pthread_create(&workers[i], NULL, pool_worker, (void *)(size_t)i))
+			die("cannot create worker thread\n");
+	pthread_mutex_unlock(&lock);
+}
+
+void
+pool_submit(PoolGroup *group, void *(*func)(void *), void *arg)
+{
+	Task t;
+
+	t.func = func;
+	t.arg = arg;
+	t.group = group;
+	pthread_mutex_lock(&lock);
+	group->pending++;
+	pool_push(&deques[nextdeque], &t);
+	nextdeque = (nextdeque + 1) % nworkers;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+}
+
+/* Block until every task of the group has finished.  The caller steals
+ * queued tasks of that group itself instead of idling, so waiting from
+ * inside a task cannot starve the pool. */
+void
+pool_wait(PoolGroup *group)
+{
+	Task t;
+
+	pthread_mutex_lock(&lock);
+	while (group->pending) {
+		if (pool_steal(nworkers - 1, group, &t))
+			pool_run(&deques[nworkers], &t, 1);
+		else
+			pthread_cond_wait(&done, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* Print what every worker did since the last dump and reset the counters;
+ * busy times far apart mean the work was split unevenly. */
+void
+pool_dumpstats(FILE *fp, const char *label)
+{
+	unsigned long long total = 0, max = 0;
+	unsigned int i, active = 0;
+	Deque *d;
+
+	pthread_mutex_lock(&lock);
+	if (!deques) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	for (i = 0; i <= nworkers; i++) {
+		d = &deques[i];
+		if (i < nworkers)
+			fprintf(fp, "%s: worker %u: %lu tasks, %lu stolen, %.3f ms busy\n",
+			        label, i, d->ran, d->stolen, d->busy / 1e6);
+		else
+			fprintf(fp, "%s: caller: %lu tasks, %.3f ms busy\n",
+			        label, d->ran, d->busy / 1e6);
+		total += d->busy;
+		max = MAX(max, d->busy);
+		active += d->ran > 0;
+		d->ran = d->stolen = 0;
+		d->busy = 0;
+	}
+	if (total)
+		fprintf(fp, "%s: imbalance (max/mean busy): %.2f\n", label,
+		        (double)max * active / total);
+	pthread_mutex_unlock(&lock);
+}
+
+void
+pool_free(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&lock);
+	quit = 1;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	for (i = 0; workers && i <= nworkers; i++)
+		free(deques[i].tasks);
+	free(workers);
+	free(deques);
+	workers = NULL;
+	deques = NULL;
+	nworkers = nextdeque = 0;
+	quit = 0;
+}
@@ -0,0 +1,14 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+
+/* Tasks submitted against the same group can be waited for together. */
+typedef struct {
+	unsigned int pending;
+} PoolGroup;
+
+void pool_init(unsigned int);
+void pool_submit(PoolGroup *, void *(*)(void *), void *);
+void pool_wait(PoolGroup *);
+void pool_dumpstats(FILE *, const char *);
+void pool_free(void);
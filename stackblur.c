@@ -1,23 +1,30 @@
 #include "stackblur.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include "pool.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
-void *HStackRenderingThread(void *arg) {
-	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
-	int rinsum,ginsum,binsum,routsum,goutsum,boutsum,rsum,gsum,bsum,x,y,i,yi,yw,rbs,p,sp;
-	int div=rp->radius+rp->radius+1;
-	int *stackr=malloc(div*sizeof(int));
-	int *stackg=malloc(div*sizeof(int));
-	int *stackb=malloc(div*sizeof(int));
+//The stacks are rings of STACKBLUR_RING(radius) entries indexed by a running
+//position masked with ring-1: pixel t leaves from slot t&mask and the one
+//replacing it goes to (t+div)&mask, so no %div is left in the loops. The
+//bodies are inlined into a generic kernel and one kernel per radius in
+//STACKBLUR_RADII, where radius, div and the ring size become constants.
+static inline __attribute__((always_inline)) void HStackRender(StackBlurRenderingParams *rp, int radius) {
+	int rinsum,ginsum,binsum,routsum,goutsum,boutsum,rsum,gsum,bsum,x,y,i,yi,yw,rbs,p,sp,t;
+	int div=radius+radius+1;
+	int mask=STACKBLUR_RING(radius)-1;
+	int *stackr=malloc(STACKBLUR_RING(radius)*sizeof(int));
+	int *stackg=malloc(STACKBLUR_RING(radius)*sizeof(int));
+	int *stackb=malloc(STACKBLUR_RING(radius)*sizeof(int));
 	yw=yi=rp->y*rp->w;
-	int r1=rp->radius+1;
+	int r1=radius+1;
 	for (y=rp->y;y<rp->y2;y++){
 		rinsum=ginsum=binsum=routsum=goutsum=boutsum=rsum=gsum=bsum=0;
-		for(i=-rp->radius;i<=rp->radius;i++){
+		for(i=-radius;i<=radius;i++){
 			p=(yi+MIN(rp->wm,MAX(i,0)))*4;
-			sp=i+rp->radius;
+			sp=i+radius;
 			stackr[sp]=rp->pix[p];
 			stackg[sp]=rp->pix[p+1];
 			stackb[sp]=rp->pix[p+2];
@@ -35,26 +42,25 @@ void *HStackRenderingThread(void *arg) {
 				boutsum+=stackb[sp];
 			}
 		}
-		int stackpointer;
-		int stackstart;
-		stackpointer=rp->radius;
+		t=0;
 
 		for (x=rp->x;x<rp->w;x++){
-			rp->r[yi]=rp->dv[rsum];
-			rp->g[yi]=rp->dv[gsum];
-			rp->b[yi]=rp->dv[bsum];
+			//In place: every pixel still to be read lies to the right
+			rp->pix[yi*4]=(unsigned char)STACKBLUR_DIV(rp,rsum);
+			rp->pix[yi*4+1]=(unsigned char)STACKBLUR_DIV(rp,gsum);
+			rp->pix[yi*4+2]=(unsigned char)STACKBLUR_DIV(rp,bsum);
 			
 			rsum-=routsum;
 			gsum-=goutsum;
 			bsum-=boutsum;
 
-			stackstart=stackpointer-rp->radius+div;
-			sp=stackstart%div;
+			sp=t&mask;
 			
 			routsum-=stackr[sp];
 			goutsum-=stackg[sp];
 			boutsum-=stackb[sp];
 			
+			sp=(t+div)&mask;
 			p=(yw+rp->vminx[x])*4;
 			stackr[sp]=rp->pix[p];
 			stackg[sp]=rp->pix[p+1];
@@ -68,8 +74,7 @@ void *HStackRenderingThread(void *arg) {
 			gsum+=ginsum;
 			bsum+=binsum;
 			
-			stackpointer=(stackpointer+1)%div;
-			sp=stackpointer%div;
+			sp=(t+r1)&mask;
 			
 			routsum+=stackr[sp];
 			goutsum+=stackg[sp];
@@ -79,6 +84,7 @@ void *HStackRenderingThread(void *arg) {
 			ginsum-=stackg[sp];
 			binsum-=stackb[sp];
 			
+			t++;
 			yi++;
 		}
 		yw+=rp->w;
@@ -87,130 +93,193 @@ void *HStackRenderingThread(void *arg) {
 	free(stackg);
 	free(stackb);
 	stackr=stackg=stackb=NULL;
-    pthread_exit(NULL);
 }
 
-void *VStackRenderingThread(void *arg) {
-	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
-	int rinsum,ginsum,binsum,routsum,goutsum,boutsum,rsum,gsum,bsum,x,y,i,yi,yp,rbs,p,sp;
-	int div=rp->radius+rp->radius+1;
-	int divsum=(div+1)>>1;
-	divsum*=divsum;
-	int *stackr=malloc(div*sizeof(int));
-	int *stackg=malloc(div*sizeof(int));
-	int *stackb=malloc(div*sizeof(int));
-	int r1=rp->radius+1;
+//Walks n (up to STACKBLUR_STRIP) neighbouring columns at once, so every row
+//read and write touches whole cache lines instead of one int per line; each
+//column keeps its own sums and stack, so the result is the same as one at a
+//time.
+static inline __attribute__((always_inline)) void VStackStrip(StackBlurRenderingParams *rp, int radius, int x, int n, int *stackr, int *stackg, int *stackb) {
+	int rinsum[STACKBLUR_STRIP],ginsum[STACKBLUR_STRIP],binsum[STACKBLUR_STRIP];
+	int routsum[STACKBLUR_STRIP],goutsum[STACKBLUR_STRIP],boutsum[STACKBLUR_STRIP];
+	int rsum[STACKBLUR_STRIP],gsum[STACKBLUR_STRIP],bsum[STACKBLUR_STRIP];
+	int y,i,c,yi,yp,rbs,p,sp,so,sn,t;
+	int div=radius+radius+1;
+	int mask=STACKBLUR_RING(radius)-1;
+	int r1=radius+1;
 	int hm=rp->H-rp->y-1;
-	for (x=rp->x;x<rp->w;x++) {
-		rinsum=ginsum=binsum=routsum=goutsum=boutsum=rsum=gsum=bsum=0;
-		yp=(rp->y-rp->radius)*rp->w;
-		for(i=-rp->radius;i<=rp->radius;i++) {
-			yi=MAX(0,yp)+x;
-			sp=i+rp->radius;
+	for (c=0;c<n;c++)
+		rinsum[c]=ginsum[c]=binsum[c]=routsum[c]=goutsum[c]=boutsum[c]=rsum[c]=gsum[c]=bsum[c]=0;
+	yp=(rp->y-radius)*rp->w;
+	for(i=-radius;i<=radius;i++) {
+		yi=MAX(0,yp)+x;
+		sp=(i+radius)*STACKBLUR_STRIP;
+		rbs=r1-abs(i);
+		for (c=0;c<n;c++) {
+			stackr[sp+c]=rp->pix[(yi+c)*4];
+			stackg[sp+c]=rp->pix[(yi+c)*4+1];
+			stackb[sp+c]=rp->pix[(yi+c)*4+2];
+
+			rsum[c]+=stackr[sp+c]*rbs;
+			gsum[c]+=stackg[sp+c]*rbs;
+			bsum[c]+=stackb[sp+c]*rbs;
 
-			stackr[sp]=rp->r[yi];
-			stackg[sp]=rp->g[yi];
-			stackb[sp]=rp->b[yi];
-			
-			rbs=r1-abs(i);
-			
-			rsum+=rp->r[yi]*rbs;
-			gsum+=rp->g[yi]*rbs;
-			bsum+=rp->b[yi]*rbs;
-			
 			if (i>0){
-				rinsum+=stackr[sp];
-				ginsum+=stackg[sp];
-				binsum+=stackb[sp];
+				rinsum[c]+=stackr[sp+c];
+				ginsum[c]+=stackg[sp+c];
+				binsum[c]+=stackb[sp+c];
 			} else {
-				routsum+=stackr[sp];
-				goutsum+=stackg[sp];
-				boutsum+=stackb[sp];
-			}
-			
-			if(i<hm){
-				yp+=rp->w;
+				routsum[c]+=stackr[sp+c];
+				goutsum[c]+=stackg[sp+c];
+				boutsum[c]+=stackb[sp+c];
 			}
 		}
-		yi=rp->y*rp->w+x;
-		int stackpointer;
-		int stackstart;
-		stackpointer=rp->radius;
 
-		for (y=rp->y;y<rp->y2;y++) {
-			p=yi*4;
-#ifdef DEBUG
-// 		fprintf(stdout,"y: %i %i %i 1\n",rp->y, x, y);
-#endif
- 			rp->pix[p]=(unsigned char)(rp->dv[rsum]);
- 			rp->pix[p+1]=(unsigned char)(rp->dv[gsum]);
- 			rp->pix[p+2]=(unsigned char)(rp->dv[bsum]);
- 			rp->pix[p+3]=0xff;
-#ifdef DEBUG
-// 		fprintf(stdout,"y: %i 2\n",rp->y);
-#endif
+		if(i<hm){
+			yp+=rp->w;
+		}
+	}
+	yi=rp->y*rp->w+x;
+	t=0;
 
-			rsum-=routsum;
-			gsum-=goutsum;
-			bsum-=boutsum;
+	for (y=rp->y;y<rp->y2;y++) {
+		so=(t&mask)*STACKBLUR_STRIP;
+		sp=((t+div)&mask)*STACKBLUR_STRIP;
+		sn=((t+r1)&mask)*STACKBLUR_STRIP;
+		p=x+rp->vminy[y];
+		for (c=0;c<n;c++) {
+ 			rp->pix[(yi+c)*4]=(unsigned char)STACKBLUR_DIV(rp,rsum[c]);
+ 			rp->pix[(yi+c)*4+1]=(unsigned char)STACKBLUR_DIV(rp,gsum[c]);
+ 			rp->pix[(yi+c)*4+2]=(unsigned char)STACKBLUR_DIV(rp,bsum[c]);
+ 			rp->pix[(yi+c)*4+3]=0xff;
 
-			stackstart=stackpointer-rp->radius+div;
-			sp=stackstart%div;
-			
-			routsum-=stackr[sp];
-			goutsum-=stackg[sp];
-			boutsum-=stackb[sp];
-			
-			p=x+rp->vminy[y];
-			stackr[sp]=rp->r[p];
-			stackg[sp]=rp->g[p];
-			stackb[sp]=rp->b[p];
-			
-			rinsum+=stackr[sp];
-			ginsum+=stackg[sp];
-			binsum+=stackb[sp];
+			rsum[c]-=routsum[c];
+			gsum[c]-=goutsum[c];
+			bsum[c]-=boutsum[c];
 
-			rsum+=rinsum;
-			gsum+=ginsum;
-			bsum+=binsum;
+			routsum[c]-=stackr[so+c];
+			goutsum[c]-=stackg[so+c];
+			boutsum[c]-=stackb[so+c];
 
-			stackpointer=(stackpointer+1)%div;
-			
-			routsum+=stackr[stackpointer];
-			goutsum+=stackg[stackpointer];
-			boutsum+=stackb[stackpointer];
-			
-			rinsum-=stackr[stackpointer];
-			ginsum-=stackg[stackpointer];
-			binsum-=stackb[stackpointer];
+			stackr[sp+c]=rp->pix[(p+c)*4];
+			stackg[sp+c]=rp->pix[(p+c)*4+1];
+			stackb[sp+c]=rp->pix[(p+c)*4+2];
 
-			yi+=rp->w;
+			rinsum[c]+=stackr[sp+c];
+			ginsum[c]+=stackg[sp+c];
+			binsum[c]+=stackb[sp+c];
+
+			rsum[c]+=rinsum[c];
+			gsum[c]+=ginsum[c];
+			bsum[c]+=binsum[c];
+
+			routsum[c]+=stackr[sn+c];
+			goutsum[c]+=stackg[sn+c];
+			boutsum[c]+=stackb[sn+c];
+
+			rinsum[c]-=stackr[sn+c];
+			ginsum[c]-=stackg[sn+c];
+			binsum[c]-=stackb[sn+c];
 		}
+		t++;
+		yi+=rp->w;
 	}
+}
+
+static inline __attribute__((always_inline)) void VStackRender(StackBlurRenderingParams *rp, int radius) {
+	int x;
+	int *stackr=malloc(STACKBLUR_RING(radius)*STACKBLUR_STRIP*sizeof(int));
+	int *stackg=malloc(STACKBLUR_RING(radius)*STACKBLUR_STRIP*sizeof(int));
+	int *stackb=malloc(STACKBLUR_RING(radius)*STACKBLUR_STRIP*sizeof(int));
+	for (x=rp->x;x<rp->x2;x+=STACKBLUR_STRIP)
+		VStackStrip(rp,radius,x,MIN(STACKBLUR_STRIP,rp->x2-x),stackr,stackg,stackb);
 	free(stackr);
 	free(stackg);
 	free(stackb);
 	stackr=stackg=stackb=NULL;
-    pthread_exit(NULL);
+}
+
+void *HStackRenderingThread(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	HStackRender(rp,rp->radius);
+	return NULL;
+}
+
+void VStackRenderingStrip(StackBlurRenderingParams *rp, int x, int n, int *stackr, int *stackg, int *stackb) {
+	VStackStrip(rp,rp->radius,x,n,stackr,stackg,stackb);
+}
+
+void *VStackRenderingThread(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	VStackRender(rp,rp->radius);
+	return NULL;
+}
+
+#define STACKBLUR_KERNELS(R) \
+static void *HStackRenderingThread##R(void *arg) { \
+	HStackRender((StackBlurRenderingParams*)arg,R); \
+	return NULL; \
+} \
+static void *VStackRenderingThread##R(void *arg) { \
+	VStackRender((StackBlurRenderingParams*)arg,R); \
+	return NULL; \
+}
+STACKBLUR_RADII(STACKBLUR_KERNELS)
+#undef STACKBLUR_KERNELS
+
+//Scalar kernels for radius, the specialised ones if there are any
+static void stackblur_scalar(int radius, void *(**h)(void *), void *(**v)(void *)) {
+	*h=HStackRenderingThread;
+	*v=VStackRenderingThread;
+#define STACKBLUR_KERNELS(R) \
+	if (radius==R) { \
+		*h=HStackRenderingThread##R; \
+		*v=VStackRenderingThread##R; \
+	}
+	STACKBLUR_RADII(STACKBLUR_KERNELS)
+#undef STACKBLUR_KERNELS
+}
+
+//The kernels divide weighted sums of at most 255*divsum by divsum. Instead of
+//a 256*divsum entry lookup table (113k ints at radius 20) this finds mul and
+//shg so that (sum*mul)>>shg is exactly sum/divsum over that whole range:
+//with n bits for the sum and l=ceil(log2(divsum)), mul=ceil(2^(n+l)/divsum)
+//is exact for every sum below 2^n and the product fits in 64 bits.
+void stackblur_divisor(int radius, unsigned long long *mul, int *shg) {
+	unsigned long long divsum=(unsigned long long)(radius+1)*(radius+1);
+	int n=0,l=0;
+	while ((1ULL<<n)<=255*divsum)
+		n++;
+	while ((1ULL<<l)<divsum)
+		l++;
+	*shg=n+l;
+	*mul=((1ULL<<*shg)+divsum-1)/divsum;
+}
+
+//Kernels used by stackblur(), scalar until stackblur_setkernel() picks others
+static int kernel=-1;
+static void *(*hkernel)(void *)=HStackRenderingThread;
+static void *(*vkernel)(void *)=VStackRenderingThread;
+
+int stackblur_setkernel(int k) {
+	hkernel=HStackRenderingThread;
+	vkernel=VStackRenderingThread;
+	kernel=stacksimd_select(k,&hkernel,&vkernel);
+	return kernel;
 }
 
 void stackblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads) {
 	if (radius<1)
 		return;
+	//Both passes blur in place: a kernel only reads pixels ahead of the one
+	//it writes, rows are split between H tiles and columns between V tiles,
+	//so no intermediate buffer is needed
 	char *pix=image->data;
-	int wh=w*h;
-	int *r=malloc(wh*sizeof(int));
-	int *g=malloc(wh*sizeof(int));
-	int *b=malloc(wh*sizeof(int));
 	int i;
 
-	int div=radius+radius+1;
-	int divsum=(div+1)>>1;
-	divsum*=divsum;
-	int *dv=malloc(256*divsum*sizeof(int));
-	for (i=0;i<256*divsum;i++) {
-		dv[i]=(i/divsum);
-	}
+	unsigned long long mul;
+	int shg;
+	stackblur_divisor(radius,&mul,&shg);
 	int *vminx=malloc(w*sizeof(int));
 	for (i=0;i<w;i++)
 		vminx[i]=MIN(i+radius+1,w-1);
@@ -218,59 +287,72 @@ void stackblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int n
 	for (i=0;i<h;i++)
 		vminy[i]=MIN(i+radius+1,h-1)*w;
 
-	pthread_t *pthh=malloc(num_threads*sizeof(pthread_t));
-	StackBlurRenderingParams *rp=malloc(num_threads*sizeof(StackBlurRenderingParams));
-	int threadY=y;
-	int threadH=(h/num_threads);
- 	for (i=0;i<num_threads;i++) {
+	PoolGroup group={0};
+	pool_init(num_threads);
+	if (kernel<0)
+		stackblur_setkernel(StackBlurLast-1);
+	void *(*hpass)(void *)=hkernel;
+	void *(*vpass)(void *)=vkernel;
+	//The vector kernels multiply in 16 bit lanes
+	if (kernel==StackBlurScalar || radius>STACKBLUR_SIMD_MAXRADIUS)
+		stackblur_scalar(radius,&hpass,&vpass);
+	//Many small tiles instead of one stripe per thread, so workers that finish early steal the rest
+	int tiles=num_threads*STACKBLUR_TILES_PER_THREAD;
+	int tileH=MAX(1,(h+tiles-1)/tiles);
+	int tileW=MAX(1,(w+tiles-1)/tiles);
+	tileW=(tileW+STACKBLUR_STRIP-1)/STACKBLUR_STRIP*STACKBLUR_STRIP;
+	int nh=(h+tileH-1)/tileH;
+	int nv=(w+tileW-1)/tileW;
+	StackBlurRenderingParams *rp=malloc((nh+nv)*sizeof(StackBlurRenderingParams));
+ 	for (i=0;i<nh+nv;i++) {
 		rp[i].pix=(unsigned char*)pix;
-		rp[i].x=x;
 		rp[i].w=w;
-		rp[i].y=threadY;
-		//Below "if" is to avoid vertical threads running on the same line when h/num_threads is not a round number i.e. 1080 lines / 16 threads = 67.5 lines!
-		if (i==num_threads-1)//last turn
+		if (i<nh) {
+			//H tile: a group of full rows
+			rp[i].x=x;
+			rp[i].x2=x+w;
+			rp[i].y=y+i*tileH;
+			rp[i].y2=MIN(rp[i].y+tileH,y+h);
+		} else {
+			//V tile: a group of full columns
+			rp[i].x=x+(i-nh)*tileW;
+			rp[i].x2=MIN(rp[i].x+tileW,x+w);
+			rp[i].y=y;
 			rp[i].y2=y+h;
-		else
-			rp[i].y2=threadY+threadH;
+		}
  		rp[i].H=h;
 		rp[i].wm=rp[i].w-1;
-		rp[i].wh=wh;
-		rp[i].r=r;
-		rp[i].g=g;
-		rp[i].b=b;
-		rp[i].dv=dv;
+		rp[i].mul=mul;
+		rp[i].shg=shg;
 		rp[i].radius=radius;
 		rp[i].vminx=vminx;
 		rp[i].vminy=vminy;
+	}
+	for (i=0;i<nh;i++) {
 #ifdef DEBUG
-		fprintf(stdout,"HThread: %i X: %i Y: %i W: %i H: %i x: %i y: %i w: %i h: %i\n",i,x,y,w,h,rp[i].x,rp[i].y,rp[i].w,threadH);
+		fprintf(stdout,"HTile: %i X: %i Y: %i W: %i H: %i y: %i y2: %i\n",i,x,y,w,h,rp[i].y,rp[i].y2);
 #endif
-		pthread_create(&pthh[i],NULL,HStackRenderingThread,(void*)&rp[i]);
-		threadY+=threadH;
+		pool_submit(&group,hpass,(void*)&rp[i]);
 	}
-	for (i=0;i<num_threads;i++)
-		pthread_join(pthh[i],NULL);
-	pthread_t *pthv=malloc(num_threads*sizeof(pthread_t));
-	for (i=0;i<num_threads;i++) {
+	pool_wait(&group);
 #ifdef DEBUG
- 		fprintf(stdout,"VThread: %i X: %i Y: %i W: %i H: %i x: %i y: %i w: %i h: %i\n",i,x,y,w,h,rp[i].x,rp[i].y,rp[i].w,threadH);
+	pool_dumpstats(stdout,"stackblur H");
 #endif
-		pthread_create(&pthv[i],NULL,VStackRenderingThread,(void*)&rp[i]);
+	for (i=nh;i<nh+nv;i++) {
+#ifdef DEBUG
+ 		fprintf(stdout,"VTile: %i X: %i Y: %i W: %i H: %i x: %i x2: %i\n",i-nh,x,y,w,h,rp[i].x,rp[i].x2);
+#endif
+		pool_submit(&group,vpass,(void*)&rp[i]);
 	}
-	for (i=0;i<num_threads;i++)
-		pthread_join(pthv[i],NULL);
+	pool_wait(&group);
+#ifdef DEBUG
+	pool_dumpstats(stdout,"stackblur V");
+#endif
 	free(vminx);
 	free(vminy);
 	free(rp);
-	free(r);
-	free(g);
-	free(b);
-	free(dv);
-	free(pthh);
-	free(pthv);
 	rp=NULL;
-	dv=vminx=vminy=r=g=b=NULL;
-	pthh=pthv=NULL;
+	vminx=vminy=NULL;
 #ifdef DEBUG
  	fprintf(stdout,"Done.\n");
 #endif
@@ -39,30 +39,55 @@
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrandr.h>
 
+//Tiles queued per worker and pass; idle workers steal the leftovers
+#define STACKBLUR_TILES_PER_THREAD 8
+//Columns the vertical pass walks together, 16 ints fill a 64 byte cache line
+#define STACKBLUR_STRIP 16
+
 typedef struct {
 	unsigned char *pix;
 	int x;
+	int x2;
 	int y;
 	int w;
 	int y2;
 	int H;
 	int wm;
-	int wh;
-	int *r;
-	int *g;
-	int *b;
-	int *dv;
+	unsigned long long mul;
+	int shg;
 	int radius;
 	int *vminx;
 	int *vminy;
 } StackBlurRenderingParams;
 
-#include <pthread.h>
+//Radii with their own scalar kernels, see stackblur.c
+#define STACKBLUR_RADII(X) X(4) X(8) X(12) X(16) X(20) X(32)
+//Entries in a stack ring: the power of two above div=2*radius+1
+#define STACKBLUR_RING(radius) (1<<(32-__builtin_clz(2*(radius))))
+
+//Blur kernels, stackblur() uses the best one the CPU supports
+enum { StackBlurScalar, StackBlurSSE2, StackBlurSSSE3, StackBlurAVX2, StackBlurLast };
+
+//Exact sum/divsum for every sum a kernel can produce, see stackblur_divisor()
+#define STACKBLUR_DIV(rp,s) ((int)(((unsigned long long)(s)*(rp)->mul)>>(rp)->shg))
+
+//Larger radii always run the scalar kernels
+#define STACKBLUR_SIMD_MAXRADIUS 254
 
 void *HStackRenderingThread(void *arg);
 
+//The stacks hold STACKBLUR_RING(radius)*STACKBLUR_STRIP ints each
+void VStackRenderingStrip(StackBlurRenderingParams *rp, int x, int n, int *stackr, int *stackg, int *stackb);
+
 void *VStackRenderingThread(void *arg);
 
+void stackblur_divisor(int radius, unsigned long long *mul, int *shg);
+
+//Picks the best supported kernel up to k and returns it
+int stackblur_setkernel(int k);
+
+int stacksimd_select(int k, void *(**h)(void *), void *(**v)(void *));
+
 void stackblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads);
 
 
@@ -0,0 +1,237 @@
+#include "stackconv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+//Width in bits of a mask without holes, 0 for anything else
+static int maskbits(unsigned long mask) {
+	int n=0;
+	if (!mask)
+		return 0;
+	mask>>=__builtin_ctzl(mask);
+	while (mask&1) {
+		mask>>=1;
+		n++;
+	}
+	return mask?0:n;
+}
+
+static int okmask(unsigned long mask) {
+	int n=maskbits(mask);
+	return n>0&&n<=16;
+}
+
+int stackconv_format(XImage *image) {
+	int bpp=image->bits_per_pixel;
+	int lsb=image->byte_order==LSBFirst;
+	unsigned long r=image->red_mask,g=image->green_mask,b=image->blue_mask;
+	if (image->format!=ZPixmap)
+		return StackConvNone;
+	if (bpp==32&&r==0xff0000&&g==0xff00&&b==0xff&&lsb)
+		return image->bytes_per_line==image->width*4?StackConvNative:StackConvXRGB32;
+	if (bpp==24&&r==0xff0000&&g==0xff00&&b==0xff&&lsb)
+		return StackConvRGB24;
+	if (bpp==16&&r==0xf800&&g==0x7e0&&b==0x1f&&lsb)
+		return StackConvRGB565;
+	if (bpp==32&&r==0x3ff00000&&g==0xffc00&&b==0x3ff&&lsb)
+		return StackConvXRGB2101010;
+	if ((bpp==16||bpp==24||bpp==32)&&okmask(r)&&okmask(g)&&okmask(b))
+		return StackConvMasks;
+	return StackConvNone;
+}
+
+static unsigned int readpx(unsigned char *s, int bpp, int msb) {
+	switch (bpp) {
+	case 16:
+		return msb?s[0]<<8|s[1]:s[1]<<8|s[0];
+	case 24:
+		return msb?s[0]<<16|s[1]<<8|s[2]:s[2]<<16|s[1]<<8|s[0];
+	default:
+		return msb?(unsigned int)s[0]<<24|s[1]<<16|s[2]<<8|s[3]
+		          :(unsigned int)s[3]<<24|s[2]<<16|s[1]<<8|s[0];
+	}
+}
+
+static void writepx(unsigned char *d, unsigned int v, int bpp, int msb) {
+	int i,n=bpp/8;
+	for (i=0;i<n;i++)
+		d[msb?n-1-i:i]=(unsigned char)(v>>(8*i));
+}
+
+void *StackUnpackRenderingThread(void *arg) {
+	StackConvRenderingParams *rp=(StackConvRenderingParams*)arg;
+	unsigned char *s,*d;
+	unsigned int v,r,g,b;
+	int x,y,c;
+	for (y=rp->y;y<rp->y2;y++) {
+		s=rp->pix+y*rp->stride;
+		d=rp->work+y*rp->w*4;
+		switch (rp->format) {
+		case StackConvXRGB32:
+			memcpy(d,s,rp->w*4);
+			break;
+		case StackConvRGB24:
+			for (x=0;x<rp->w;x++,s+=3,d+=4) {
+				d[0]=s[0];
+				d[1]=s[1];
+				d[2]=s[2];
+				d[3]=0xff;
+			}
+			break;
+		case StackConvRGB565:
+			//Top bits repeated into the bottom ones, so white stays white
+			for (x=0;x<rp->w;x++,s+=2,d+=4) {
+				v=s[1]<<8|s[0];
+				r=v>>11;
+				g=(v>>5)&0x3f;
+				b=v&0x1f;
+				d[0]=b<<3|b>>2;
+				d[1]=g<<2|g>>4;
+				d[2]=r<<3|r>>2;
+				d[3]=0xff;
+			}
+			break;
+		case StackConvXRGB2101010:
+			for (x=0;x<rp->w;x++,s+=4,d+=4) {
+				v=(unsigned int)s[3]<<24|s[2]<<16|s[1]<<8|s[0];
+				d[0]=(v>>2)&0xff;
+				d[1]=(v>>12)&0xff;
+				d[2]=(v>>22)&0xff;
+				d[3]=0xff;
+			}
+			break;
+		default:
+			for (x=0;x<rp->w;x++,s+=rp->bpp/8,d+=4) {
+				v=readpx(s,rp->bpp,rp->msb);
+				for (c=0;c<3;c++)
+					d[2-c]=rp->to8[c][(v&rp->mask[c])>>rp->shift[c]];
+				d[3]=0xff;
+			}
+		}
+	}
+	return NULL;
+}
+
+void *StackPackRenderingThread(void *arg) {
+	StackConvRenderingParams *rp=(StackConvRenderingParams*)arg;
+	unsigned char *s,*d;
+	unsigned int v,c10;
+	int x,y,c;
+	for (y=rp->y;y<rp->y2;y++) {
+		d=rp->pix+y*rp->stride;
+		s=rp->work+y*rp->w*4;
+		switch (rp->format) {
+		case StackConvXRGB32:
+			memcpy(d,s,rp->w*4);
+			break;
+		case StackConvRGB24:
+			for (x=0;x<rp->w;x++,s+=4,d+=3) {
+				d[0]=s[0];
+				d[1]=s[1];
+				d[2]=s[2];
+			}
+			break;
+		case StackConvRGB565:
+			for (x=0;x<rp->w;x++,s+=4,d+=2) {
+				//Rounded, and the inverse of the unpacking
+				v=(s[2]*31+127)/255<<11|(s[1]*63+127)/255<<5|(s[0]*31+127)/255;
+				d[0]=v&0xff;
+				d[1]=v>>8;
+			}
+			break;
+		case StackConvXRGB2101010:
+			for (x=0;x<rp->w;x++,s+=4,d+=4) {
+				v=0xc0000000U;
+				for (c=0;c<3;c++) {
+					c10=s[c]<<2|s[c]>>6;
+					v|=c10<<(10*c);
+				}
+				d[0]=v&0xff;
+				d[1]=(v>>8)&0xff;
+				d[2]=(v>>16)&0xff;
+				d[3]=v>>24;
+			}
+			break;
+		default:
+			for (x=0;x<rp->w;x++,s+=4,d+=rp->bpp/8) {
+				v=0;
+				for (c=0;c<3;c++)
+					v|=(unsigned int)rp->from8[c][s[2-c]]<<rp->shift[c];
+				writepx(d,v,rp->bpp,rp->msb);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void stackconv(XImage *image, XImage *work, void *(*pass)(void *), unsigned int num_threads) {
+	int format=stackconv_format(image);
+	unsigned long mask[3]={image->red_mask,image->green_mask,image->blue_mask};
+	unsigned char *to8[3]={NULL,NULL,NULL};
+	unsigned short *from8[3]={NULL,NULL,NULL};
+	int shift[3]={0,0,0};
+	unsigned int i,v,max;
+	int c;
+
+	if (format==StackConvNative||format==StackConvNone)
+		return;
+	//Other masks scale every channel through a table each way
+	if (format==StackConvMasks)
+		for (c=0;c<3;c++) {
+			shift[c]=__builtin_ctzl(mask[c]);
+			max=mask[c]>>shift[c];
+			to8[c]=malloc(max+1);
+			from8[c]=malloc(256*sizeof(unsigned short));
+			for (v=0;v<=max;v++)
+				to8[c][v]=(v*255+max/2)/max;
+			for (v=0;v<256;v++)
+				from8[c][v]=(v*max+127)/255;
+		}
+
+	PoolGroup group={0};
+	pool_init(num_threads);
+	StackConvRenderingParams *rp=malloc(num_threads*sizeof(StackConvRenderingParams));
+	int threadY=0;
+	int threadH=(image->height/num_threads);
+	for (i=0;i<num_threads;i++) {
+		rp[i].pix=(unsigned char*)image->data;
+		rp[i].work=(unsigned char*)work->data;
+		rp[i].w=image->width;
+		rp[i].stride=image->bytes_per_line;
+		rp[i].format=format;
+		rp[i].bpp=image->bits_per_pixel;
+		rp[i].msb=image->byte_order==MSBFirst;
+		for (c=0;c<3;c++) {
+			rp[i].shift[c]=shift[c];
+			rp[i].mask[c]=mask[c];
+			rp[i].to8[c]=to8[c];
+			rp[i].from8[c]=from8[c];
+		}
+		rp[i].y=threadY;
+		if (i==num_threads-1)//last turn
+			rp[i].y2=image->height;
+		else
+			rp[i].y2=threadY+threadH;
+#ifdef DEBUG
+		fprintf(stdout,"Thread: %i y: %i y2: %i format: %i\n", i, rp[i].y, rp[i].y2, format);
+#endif
+		pool_submit(&group,pass,(void*)&rp[i]);
+		threadY+=threadH;
+	}
+	pool_wait(&group);
+	free(rp);
+	rp=NULL;
+	for (c=0;c<3;c++) {
+		free(to8[c]);
+		free(from8[c]);
+	}
+}
+
+void stackconv_unpack(XImage *image, XImage *work, unsigned int num_threads) {
+	stackconv(image,work,StackUnpackRenderingThread,num_threads);
+}
+
+void stackconv_pack(XImage *work, XImage *image, unsigned int num_threads) {
+	stackconv(image,work,StackPackRenderingThread,num_threads);
+}
@@ -0,0 +1,44 @@
+//#define DEBUG
+
+// Pixel format conversion
+//
+// The blur and tint kernels work on tight rows of 32 bit pixels, blue,
+// green, red and alpha bytes in that order. Screens with other formats
+// (packed 24 bit, 16 bit 565, 30 bit deep colour, padded rows or the
+// other byte order) are converted to that in one pass and back in another.
+// The usual formats have loops of their own, anything else with colour
+// masks goes through lookup tables.
+
+#include <X11/Xlib.h>
+
+enum { StackConvNative, StackConvXRGB32, StackConvRGB24, StackConvRGB565,
+       StackConvXRGB2101010, StackConvMasks, StackConvNone };
+
+typedef struct {
+	unsigned char *pix;
+	unsigned char *work;
+	int y;
+	int y2;
+	int w;
+	int stride;
+	int format;
+	int bpp;
+	int msb;
+	//StackConvMasks only: shift and tables of every channel, red first
+	int shift[3];
+	unsigned long mask[3];
+	unsigned char *to8[3];
+	unsigned short *from8[3];
+} StackConvRenderingParams;
+
+//Which of the above image is in, StackConvNative needs no conversion
+int stackconv_format(XImage *image);
+
+void *StackUnpackRenderingThread(void *arg);
+
+void *StackPackRenderingThread(void *arg);
+
+//image to work, a tight 32 bit image of the same size, and back
+void stackconv_unpack(XImage *image, XImage *work, unsigned int num_threads);
+
+void stackconv_pack(XImage *work, XImage *image, unsigned int num_threads);
@@ -0,0 +1,219 @@
+#include "stackscale.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+//Pixels are handled as words, with two channels in the low bytes of the
+//16 bit lanes of LO() and HI() so one multiply covers both
+#define LO(p) ((p)&0x00ff00ffU)
+#define HI(p) (((p)>>8)&0x00ff00ffU)
+
+static unsigned int lerp(unsigned int a, unsigned int b, unsigned int w) {
+	return (((LO(a)*(256-w)+LO(b)*w+0x00800080U)>>8)&0x00ff00ffU)
+	     | ((HI(a)*(256-w)+HI(b)*w+0x00800080U)&0xff00ff00U);
+}
+
+//Channels of rows y to y2 summed column by column into acc
+static void stackscale_sum(StackScaleRenderingParams *rp, int y, int y2, unsigned short *acc) {
+	unsigned char *in=rp->pix+y*rp->w*4;
+	int x=0,i;
+#ifdef __SSE2__
+	const __m128i zero=_mm_setzero_si128();
+	for (;x+16<=rp->w*4;x+=16) {
+		__m128i lo=zero,hi=zero,p;
+		for (i=0;i<y2-y;i++) {
+			p=_mm_loadu_si128((__m128i*)(in+i*rp->w*4+x));
+			lo=_mm_add_epi16(lo,_mm_unpacklo_epi8(p,zero));
+			hi=_mm_add_epi16(hi,_mm_unpackhi_epi8(p,zero));
+		}
+		_mm_storeu_si128((__m128i*)(acc+x),lo);
+		_mm_storeu_si128((__m128i*)(acc+x+8),hi);
+	}
+#endif
+	for (;x<rp->w*4;x++)
+		for (acc[x]=0,i=0;i<y2-y;i++)
+			acc[x]+=in[i*rp->w*4+x];
+}
+
+//Box filter: every small pixel is the mean of the factor x factor block it covers,
+//blocks on the right and bottom edges may be cut short
+void *StackDownRenderingThread(void *arg) {
+	StackScaleRenderingParams *rp=(StackScaleRenderingParams*)arg;
+	int sx,sy,x,x2,y2,n,shift;
+	unsigned int r,g,b,*out;
+	unsigned short *acc=malloc(rp->w*4*sizeof(unsigned short));
+	//Full blocks of a power of two factor divide with a shift
+	for (shift=0;(1<<shift)<rp->factor*rp->factor;shift++);
+	for (sy=rp->y;sy<rp->y2;sy++) {
+		y2=MIN(sy*rp->factor+rp->factor,rp->h);
+		stackscale_sum(rp,sy*rp->factor,y2,acc);
+		out=(unsigned int*)rp->small+sy*rp->sw;
+		for (sx=0;sx<rp->sw;sx++) {
+			x2=MIN(sx*rp->factor+rp->factor,rp->w);
+			r=g=b=0;
+			for (x=sx*rp->factor;x<x2;x++) {
+				b+=acc[x*4];
+				g+=acc[x*4+1];
+				r+=acc[x*4+2];
+			}
+			n=(y2-sy*rp->factor)*(x2-sx*rp->factor);
+			if (n==1<<shift)
+				out[sx]=0xff000000U|((r+n/2)>>shift)<<16|((g+n/2)>>shift)<<8|((b+n/2)>>shift);
+			else
+				out[sx]=0xff000000U|((r+n/2)/n)<<16|((g+n/2)/n)<<8|((b+n/2)/n);
+		}
+	}
+	free(acc);
+	return NULL;
+}
+
+#ifdef __SSE2__
+//lerp() for 4 pixels, w0 and w1 hold the weights of the 2 pixels in each half
+static __m128i lerp_sse2(__m128i a, __m128i b, __m128i w0, __m128i w1) {
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i x256=_mm_set1_epi16(256);
+	const __m128i half=_mm_set1_epi16(128);
+	__m128i lo=_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a,zero),_mm_sub_epi16(x256,w0)),
+	                         _mm_mullo_epi16(_mm_unpacklo_epi8(b,zero),w0));
+	__m128i hi=_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a,zero),_mm_sub_epi16(x256,w1)),
+	                         _mm_mullo_epi16(_mm_unpackhi_epi8(b,zero),w1));
+	lo=_mm_srli_epi16(_mm_add_epi16(lo,half),8);
+	hi=_mm_srli_epi16(_mm_add_epi16(hi,half),8);
+	return _mm_packus_epi16(lo,hi);
+}
+#endif
+
+//Small row sy stretched to full width
+static void stackscale_row(StackScaleRenderingParams *rp, int sy, unsigned int *row) {
+	unsigned int *in=(unsigned int*)rp->small+sy*rp->sw;
+	int x=0;
+#ifdef __SSE2__
+	for (;x+4<=rp->w;x+=4) {
+		__m128i a=_mm_set_epi32(in[rp->x0[x+3]],in[rp->x0[x+2]],in[rp->x0[x+1]],in[rp->x0[x]]);
+		__m128i b=_mm_set_epi32(in[rp->x1[x+3]],in[rp->x1[x+2]],in[rp->x1[x+1]],in[rp->x1[x]]);
+		__m128i w0=_mm_loadu_si128((__m128i*)(rp->wx4+x*4));
+		__m128i w1=_mm_loadu_si128((__m128i*)(rp->wx4+x*4+8));
+		_mm_storeu_si128((__m128i*)(row+x),lerp_sse2(a,b,w0,w1));
+	}
+#endif
+	for (;x<rp->w;x++)
+		row[x]=lerp(in[rp->x0[x]],in[rp->x1[x]],rp->wx4[x*4]);
+}
+
+//Output row between two stretched rows, wy/256 of the way to row1
+static void stackscale_blend(unsigned int *out, unsigned int *row0, unsigned int *row1, int wy, int w) {
+	int x=0;
+#ifdef __SSE2__
+	__m128i wv=_mm_set1_epi16(wy);
+	__m128i alpha=_mm_set1_epi32(0xff000000);
+	for (;x+4<=w;x+=4)
+		_mm_storeu_si128((__m128i*)(out+x),_mm_or_si128(alpha,lerp_sse2(_mm_loadu_si128((__m128i*)(row0+x)),
+		                 _mm_loadu_si128((__m128i*)(row1+x)),wv,wv)));
+#endif
+	for (;x<w;x++)
+		out[x]=lerp(row0[x],row1[x],wy)|0xff000000U;
+}
+
+//Bilinear filter with 8 bit weights, separable: every small row a tile needs
+//is stretched once, each output row then blends the two around it
+void *StackUpRenderingThread(void *arg) {
+	StackScaleRenderingParams *rp=(StackScaleRenderingParams*)arg;
+	int y,fy,wy,sy0,sy1,have0=-1,have1=-1;
+	unsigned int *row0=malloc(rp->w*sizeof(unsigned int));
+	unsigned int *row1=malloc(rp->w*sizeof(unsigned int));
+	unsigned int *tmp;
+	for (y=rp->y;y<rp->y2;y++) {
+		//Centre of output pixel y in small pixels, times 256
+		fy=MAX(0,((2*y+1)*256)/(2*rp->factor)-128);
+		wy=fy&0xff;
+		sy0=MIN(fy>>8,rp->sh-1);
+		sy1=MIN((fy>>8)+1,rp->sh-1);
+		if (have1==sy0) {
+			tmp=row0;
+			row0=row1;
+			row1=tmp;
+			have0=have1;
+			have1=-1;
+		}
+		if (have0!=sy0)
+			stackscale_row(rp,have0=sy0,row0);
+		if (have1!=sy1)
+			stackscale_row(rp,have1=sy1,row1);
+		stackscale_blend((unsigned int*)rp->pix+y*rp->w,row0,row1,wy,rp->w);
+	}
+	free(row0);
+	free(row1);
+	return NULL;
+}
+
+static void stackscale(XImage *image, XImage *small, int factor, int *x0, int *x1, short *wx4, void *(*pass)(void *), int rows, unsigned int num_threads) {
+	int i;
+
+	PoolGroup group={0};
+	pool_init(num_threads);
+	StackScaleRenderingParams *rp=malloc(num_threads*sizeof(StackScaleRenderingParams));
+	int threadY=0;
+	int threadH=(rows/num_threads);
+ 	for (i=0;i<num_threads;i++) {
+		rp[i].pix=(unsigned char*)image->data;
+		rp[i].small=(unsigned char*)small->data;
+		rp[i].w=image->width;
+		rp[i].h=image->height;
+		rp[i].sw=small->width;
+		rp[i].sh=small->height;
+		rp[i].factor=factor;
+		rp[i].x0=x0;
+		rp[i].x1=x1;
+		rp[i].wx4=wx4;
+		rp[i].y=threadY;
+		if (i==num_threads-1)//last turn
+			rp[i].y2=rows;
+		else
+			rp[i].y2=threadY+threadH;
+#ifdef DEBUG
+		fprintf(stdout,"Thread: %i y: %i y2: %i\n", i, rp[i].y, rp[i].y2);
+#endif
+		pool_submit(&group,pass,(void*)&rp[i]);
+		threadY+=threadH;
+	}
+	pool_wait(&group);
+	free(rp);
+	rp=NULL;
+}
+
+void stackscale_down(XImage *image, XImage *small, int factor, unsigned int num_threads) {
+	stackscale(image,small,factor,NULL,NULL,NULL,StackDownRenderingThread,small->height,num_threads);
+}
+
+void stackscale_up(XImage *small, XImage *image, int factor, unsigned int num_threads) {
+	int x,c,fx;
+	int *x0=malloc(image->width*sizeof(int));
+	int *x1=malloc(image->width*sizeof(int));
+	short *wx4=malloc(image->width*4*sizeof(short));
+	for (x=0;x<image->width;x++) {
+		fx=MAX(0,((2*x+1)*256)/(2*factor)-128);
+		for (c=0;c<4;c++)
+			wx4[x*4+c]=fx&0xff;
+		x0[x]=MIN(fx>>8,small->width-1);
+		x1[x]=MIN((fx>>8)+1,small->width-1);
+	}
+	stackscale(image,small,factor,x0,x1,wx4,StackUpRenderingThread,image->height,num_threads);
+	free(x0);
+	free(x1);
+	free(wx4);
+	x0=x1=NULL;
+	wx4=NULL;
+#ifdef DEBUG
+ 	fprintf(stdout,"Done.\n");
+#endif
+}
+#undef LO
+#undef HI
+#undef MIN
+#undef MAX
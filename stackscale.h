@@ -0,0 +1,27 @@
+//#define DEBUG
+
+#include <X11/Xlib.h>
+
+typedef struct {
+	unsigned char *pix;
+	unsigned char *small;
+	int y;
+	int y2;
+	int w;
+	int h;
+	int sw;
+	int sh;
+	int factor;
+	int *x0;
+	int *x1;
+	//Weight of x1 for every channel of every pixel
+	short *wx4;
+} StackScaleRenderingParams;
+
+void *StackDownRenderingThread(void *arg);
+
+void *StackUpRenderingThread(void *arg);
+
+void stackscale_down(XImage *image, XImage *small, int factor, unsigned int num_threads);
+
+void stackscale_up(XImage *small, XImage *image, int factor, unsigned int num_threads);
@@ -0,0 +1,319 @@
+//SSE2/SSSE3/AVX2 versions of the stack blur passes.
+//
+//They do exactly the same integer arithmetic as HStackRenderingThread and
+//VStackRenderingThread in stackblur.c, which stay the reference, but keep
+//the channels of a pixel (horizontal pass) or neighbouring columns
+//(vertical pass) in vector lanes. stacksimd_select() picks them by CPUID.
+
+#include "stackblur.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define SSSE3 __attribute__((target("ssse3")))
+#define AVX2 __attribute__((target("avx2")))
+
+static void *simd_alloc(size_t size) {
+	void *p;
+	if (posix_memalign(&p,32,size))
+		return NULL;
+	return p;
+}
+
+//B,G,R,A bytes of one pixel into four 32 bit lanes and back
+static SSE2 __m128i loadpx_sse2(const unsigned char *p) {
+	int v;
+	__m128i zero=_mm_setzero_si128();
+	memcpy(&v,p,4);
+	return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v),zero),zero);
+}
+
+static SSE2 void storepx_sse2(unsigned char *p, __m128i px) {
+	int v=_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(px,px),px));
+	memcpy(p,&v,4);
+}
+
+static SSSE3 __m128i loadpx_ssse3(const unsigned char *p) {
+	int v;
+	memcpy(&v,p,4);
+	return _mm_shuffle_epi8(_mm_cvtsi32_si128(v),
+		_mm_setr_epi8(0,-1,-1,-1,1,-1,-1,-1,2,-1,-1,-1,3,-1,-1,-1));
+}
+
+//STACKBLUR_DIV on every 32 bit lane: 64 bit products of the even and the
+//odd lanes, shifted, then put back together
+static SSE2 __m128i div_sse2(__m128i s, __m128i m, __m128i shg) {
+	__m128i even=_mm_srl_epi64(_mm_mul_epu32(s,m),shg);
+	__m128i odd=_mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(s,32),m),shg);
+	return _mm_or_si128(_mm_and_si128(even,_mm_set1_epi64x(0xffffffff)),_mm_slli_epi64(odd,32));
+}
+
+static AVX2 __m256i div_avx2(__m256i s, __m256i m, __m128i shg) {
+	__m256i even=_mm256_srl_epi64(_mm256_mul_epu32(s,m),shg);
+	__m256i odd=_mm256_srl_epi64(_mm256_mul_epu32(_mm256_srli_epi64(s,32),m),shg);
+	return _mm256_blend_epi32(even,_mm256_slli_epi64(odd,32),0xaa);
+}
+
+//Lanes hold values below 256 and rbs fits 16 bits, so multiplying the low
+//halves with madd is exact
+#define HSTACK128(NAME,TARGET,LOAD) \
+static TARGET void *NAME(void *arg) { \
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg; \
+	int div=rp->radius+rp->radius+1; \
+	__m128i *stack=simd_alloc(div*sizeof(__m128i)); \
+	__m128i sum,insum,outsum,px; \
+	__m128i m=_mm_set1_epi64x(rp->mul),shg=_mm_cvtsi32_si128(rp->shg); \
+	int x,y,i,yi,yw,sp,sn; \
+	int r1=rp->radius+1; \
+	yw=yi=rp->y*rp->w; \
+	for (y=rp->y;y<rp->y2;y++) { \
+		sum=insum=outsum=_mm_setzero_si128(); \
+		for (i=-rp->radius;i<=rp->radius;i++) { \
+			px=LOAD(rp->pix+(yi+MIN(rp->wm,MAX(i,0)))*4); \
+			stack[i+rp->radius]=px; \
+			sum=_mm_add_epi32(sum,_mm_madd_epi16(px,_mm_set1_epi32(r1-abs(i)))); \
+			if (i>0) \
+				insum=_mm_add_epi32(insum,px); \
+			else \
+				outsum=_mm_add_epi32(outsum,px); \
+		} \
+		sp=0; \
+		sn=rp->radius; \
+		for (x=rp->x;x<rp->w;x++) { \
+			storepx_sse2(rp->pix+yi*4,div_sse2(sum,m,shg)); \
+			sum=_mm_sub_epi32(sum,outsum); \
+			outsum=_mm_sub_epi32(outsum,stack[sp]); \
+			stack[sp]=LOAD(rp->pix+(yw+rp->vminx[x])*4); \
+			insum=_mm_add_epi32(insum,stack[sp]); \
+			sum=_mm_add_epi32(sum,insum); \
+			if (++sn==div) \
+				sn=0; \
+			outsum=_mm_add_epi32(outsum,stack[sn]); \
+			insum=_mm_sub_epi32(insum,stack[sn]); \
+			if (++sp==div) \
+				sp=0; \
+			yi++; \
+		} \
+		yw+=rp->w; \
+	} \
+	free(stack); \
+	return NULL; \
+}
+
+HSTACK128(HStackRenderingSSE2,SSE2,loadpx_sse2)
+HSTACK128(HStackRenderingSSSE3,SSSE3,loadpx_ssse3)
+
+//Two pixels, one per 128 bit half
+static AVX2 __m256i loadpx2_avx2(const unsigned char *a, const unsigned char *b) {
+	int va,vb;
+	memcpy(&va,a,4);
+	memcpy(&vb,b,4);
+	return _mm256_cvtepu8_epi32(_mm_unpacklo_epi32(_mm_cvtsi32_si128(va),_mm_cvtsi32_si128(vb)));
+}
+
+//Two rows at a time, one in each 128 bit half
+static AVX2 void *HStackRenderingAVX2(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	StackBlurRenderingParams last;
+	int div=rp->radius+rp->radius+1;
+	__m256i *stack=simd_alloc(div*sizeof(__m256i));
+	__m256i sum,insum,outsum,px;
+	__m256i m=_mm256_set1_epi64x(rp->mul);
+	__m128i shg=_mm_cvtsi32_si128(rp->shg);
+	__m256i q;
+	int x,y,i,yi,yw,p,sp,sn;
+	int r1=rp->radius+1;
+	int w=rp->w;
+	yw=yi=rp->y*w;
+	for (y=rp->y;y+1<rp->y2;y+=2) {
+		sum=insum=outsum=_mm256_setzero_si256();
+		for (i=-rp->radius;i<=rp->radius;i++) {
+			p=(yi+MIN(rp->wm,MAX(i,0)))*4;
+			px=loadpx2_avx2(rp->pix+p,rp->pix+p+w*4);
+			stack[i+rp->radius]=px;
+			sum=_mm256_add_epi32(sum,_mm256_mullo_epi32(px,_mm256_set1_epi32(r1-abs(i))));
+			if (i>0)
+				insum=_mm256_add_epi32(insum,px);
+			else
+				outsum=_mm256_add_epi32(outsum,px);
+		}
+		sp=0;
+		sn=rp->radius;
+		for (x=rp->x;x<w;x++) {
+			q=div_avx2(sum,m,shg);
+			storepx_sse2(rp->pix+yi*4,_mm256_castsi256_si128(q));
+			storepx_sse2(rp->pix+(yi+w)*4,_mm256_extracti128_si256(q,1));
+			sum=_mm256_sub_epi32(sum,outsum);
+			outsum=_mm256_sub_epi32(outsum,stack[sp]);
+			p=(yw+rp->vminx[x])*4;
+			stack[sp]=loadpx2_avx2(rp->pix+p,rp->pix+p+w*4);
+			insum=_mm256_add_epi32(insum,stack[sp]);
+			sum=_mm256_add_epi32(sum,insum);
+			if (++sn==div)
+				sn=0;
+			outsum=_mm256_add_epi32(outsum,stack[sn]);
+			insum=_mm256_sub_epi32(insum,stack[sn]);
+			if (++sp==div)
+				sp=0;
+			yi++;
+		}
+		yi+=w;
+		yw+=w+w;
+	}
+	free(stack);
+	if (y<rp->y2) {
+		last=*rp;
+		last.y=y;
+		HStackRenderingSSSE3(&last);
+	}
+	return NULL;
+}
+
+//Vertical pass over one full strip of STACKBLUR_STRIP columns, N vectors of
+//L lanes per sum; the stack is laid out [div][3 channels][N]
+#define VSTRIP(NAME,TARGET,VEC,L,LOADU,STOREU,ADD,SUB,MUL,ZERO,SET1,SET1X,AND,OR,SRLI,SLLI,DIV) \
+static TARGET void NAME(StackBlurRenderingParams *rp, int x, VEC *stack) { \
+	enum { N=STACKBLUR_STRIP/L }; \
+	VEC rsum[N],gsum[N],bsum[N],rin[N],gin[N],bin[N],rout[N],gout[N],bout[N]; \
+	VEC vr,vg,vb,m,*s,*t; \
+	VEC mul=SET1X(rp->mul),alpha=SET1((int)0xff000000),mask=SET1(0xff); \
+	__m128i shg=_mm_cvtsi32_si128(rp->shg); \
+	int y,i,k,yi,yp,p,sp,sn; \
+	int div=rp->radius+rp->radius+1; \
+	int r1=rp->radius+1; \
+	int hm=rp->H-rp->y-1; \
+	for (k=0;k<N;k++) \
+		rsum[k]=gsum[k]=bsum[k]=rin[k]=gin[k]=bin[k]=rout[k]=gout[k]=bout[k]=ZERO(); \
+	yp=(rp->y-rp->radius)*rp->w; \
+	for (i=-rp->radius;i<=rp->radius;i++) { \
+		yi=MAX(0,yp)+x; \
+		s=stack+(i+rp->radius)*3*N; \
+		m=SET1(r1-abs(i)); \
+		for (k=0;k<N;k++) { \
+			vb=LOADU((VEC*)(rp->pix+(yi+k*L)*4)); \
+			s[k]=vr=AND(vb,mask); \
+			s[N+k]=vg=AND(SRLI(vb,8),mask); \
+			s[2*N+k]=vb=AND(SRLI(vb,16),mask); \
+			rsum[k]=ADD(rsum[k],MUL(vr,m)); \
+			gsum[k]=ADD(gsum[k],MUL(vg,m)); \
+			bsum[k]=ADD(bsum[k],MUL(vb,m)); \
+			if (i>0) { \
+				rin[k]=ADD(rin[k],vr); \
+				gin[k]=ADD(gin[k],vg); \
+				bin[k]=ADD(bin[k],vb); \
+			} else { \
+				rout[k]=ADD(rout[k],vr); \
+				gout[k]=ADD(gout[k],vg); \
+				bout[k]=ADD(bout[k],vb); \
+			} \
+		} \
+		if (i<hm) \
+			yp+=rp->w; \
+	} \
+	yi=rp->y*rp->w+x; \
+	sp=0; \
+	sn=rp->radius; \
+	for (y=rp->y;y<rp->y2;y++) { \
+		if (++sn==div) \
+			sn=0; \
+		s=stack+sp*3*N; \
+		t=stack+sn*3*N; \
+		p=x+rp->vminy[y]; \
+		for (k=0;k<N;k++) { \
+			vr=DIV(rsum[k],mul,shg); \
+			vg=SLLI(DIV(gsum[k],mul,shg),8); \
+			vb=SLLI(DIV(bsum[k],mul,shg),16); \
+			STOREU((VEC*)(rp->pix+(yi+k*L)*4),OR(OR(vr,vg),OR(vb,alpha))); \
+			rsum[k]=SUB(rsum[k],rout[k]); \
+			gsum[k]=SUB(gsum[k],gout[k]); \
+			bsum[k]=SUB(bsum[k],bout[k]); \
+			rout[k]=SUB(rout[k],s[k]); \
+			gout[k]=SUB(gout[k],s[N+k]); \
+			bout[k]=SUB(bout[k],s[2*N+k]); \
+			vb=LOADU((VEC*)(rp->pix+(p+k*L)*4)); \
+			s[k]=vr=AND(vb,mask); \
+			s[N+k]=vg=AND(SRLI(vb,8),mask); \
+			s[2*N+k]=vb=AND(SRLI(vb,16),mask); \
+			rin[k]=ADD(rin[k],vr); \
+			gin[k]=ADD(gin[k],vg); \
+			bin[k]=ADD(bin[k],vb); \
+			rsum[k]=ADD(rsum[k],rin[k]); \
+			gsum[k]=ADD(gsum[k],gin[k]); \
+			bsum[k]=ADD(bsum[k],bin[k]); \
+			rout[k]=ADD(rout[k],t[k]); \
+			gout[k]=ADD(gout[k],t[N+k]); \
+			bout[k]=ADD(bout[k],t[2*N+k]); \
+			rin[k]=SUB(rin[k],t[k]); \
+			gin[k]=SUB(gin[k],t[N+k]); \
+			bin[k]=SUB(bin[k],t[2*N+k]); \
+		} \
+		if (++sp==div) \
+			sp=0; \
+		yi+=rp->w; \
+	} \
+}
+
+static SSE2 __m128i madd_sse2(__m128i a, __m128i b) { return _mm_madd_epi16(a,b); }
+
+VSTRIP(VStackStripSSE2,SSE2,__m128i,4,_mm_loadu_si128,_mm_storeu_si128,
+	_mm_add_epi32,_mm_sub_epi32,madd_sse2,_mm_setzero_si128,_mm_set1_epi32,
+	_mm_set1_epi64x,_mm_and_si128,_mm_or_si128,_mm_srli_epi32,_mm_slli_epi32,div_sse2)
+VSTRIP(VStackStripAVX2,AVX2,__m256i,8,_mm256_loadu_si256,_mm256_storeu_si256,
+	_mm256_add_epi32,_mm256_sub_epi32,_mm256_mullo_epi32,_mm256_setzero_si256,_mm256_set1_epi32,
+	_mm256_set1_epi64x,_mm256_and_si256,_mm256_or_si256,_mm256_srli_epi32,_mm256_slli_epi32,div_avx2)
+
+//Full strips go through the vector code, a narrower last strip through the
+//scalar one
+#define VSTACK(NAME,TARGET,VEC,STRIP) \
+static TARGET void *NAME(void *arg) { \
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg; \
+	int x; \
+	int ring=STACKBLUR_RING(rp->radius); \
+	VEC *stack=simd_alloc(ring*3*STACKBLUR_STRIP*sizeof(int)); \
+	for (x=rp->x;x+STACKBLUR_STRIP<=rp->x2;x+=STACKBLUR_STRIP) \
+		STRIP(rp,x,stack); \
+	if (x<rp->x2) \
+		VStackRenderingStrip(rp,x,rp->x2-x,(int*)stack,(int*)stack+ring*STACKBLUR_STRIP, \
+			(int*)stack+2*ring*STACKBLUR_STRIP); \
+	free(stack); \
+	return NULL; \
+}
+
+VSTACK(VStackRenderingSSE2,SSE2,__m128i,VStackStripSSE2)
+VSTACK(VStackRenderingAVX2,AVX2,__m256i,VStackStripAVX2)
+
+int stacksimd_select(int k, void *(**h)(void *), void *(**v)(void *)) {
+	__builtin_cpu_init();
+	if (k>=StackBlurAVX2 && __builtin_cpu_supports("avx2")) {
+		*h=HStackRenderingAVX2;
+		*v=VStackRenderingAVX2;
+		return StackBlurAVX2;
+	}
+	if (k>=StackBlurSSSE3 && __builtin_cpu_supports("ssse3")) {
+		*h=HStackRenderingSSSE3;
+		*v=VStackRenderingSSE2;
+		return StackBlurSSSE3;
+	}
+	if (k>=StackBlurSSE2 && __builtin_cpu_supports("sse2")) {
+		*h=HStackRenderingSSE2;
+		*v=VStackRenderingSSE2;
+		return StackBlurSSE2;
+	}
+	return StackBlurScalar;
+}
+
+#else
+
+int stacksimd_select(int k, void *(**h)(void *), void *(**v)(void *)) {
+	return StackBlurScalar;
+}
+
+#endif
+#undef MIN
+#undef MAX
@@ -1,6 +1,7 @@
 #include "stacktint.h"
+#include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
+#include "pool.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -26,14 +27,15 @@ void *StackRenderingThread(void *arg) {
 			yi+=rp->w;
 		}
 	}
-    pthread_exit(NULL);
+	return NULL;
 }
 
 void stacktint(XImage *image, unsigned char *tint, unsigned int num_threads) {
 	char *pix=image->data;
 	int i;
 
-	pthread_t *pth=malloc(num_threads*sizeof(pthread_t));
+	PoolGroup group={0};
+	pool_init(num_threads);
 	StackTintRenderingParams *rp=malloc(num_threads*sizeof(StackTintRenderingParams));
 	int threadY=0;
 	int threadH=(image->height/num_threads);
@@ -46,20 +48,16 @@ void stacktint(XImage *image, unsigned char *tint, unsigned int num_threads) {
 			rp[i].y2=image->height;
 		else
 			rp[i].y2=threadY+threadH;
-		rp[i].tint = malloc(3 * sizeof(char));
-		memcpy(rp[i].tint, tint, 3 * sizeof(char));
+		rp[i].tint = tint;
 #ifdef DEBUG
 		fprintf(stdout,"Thread: %i y: %i w: %i h: %i\n", i, rp[i].y, rp[i].w, threadH);
 #endif
-		pthread_create(&pth[i],NULL,StackRenderingThread,(void*)&rp[i]);
+		pool_submit(&group,StackRenderingThread,(void*)&rp[i]);
 		threadY+=threadH;
 	}
-	for (i=0;i<num_threads;i++)
-		pthread_join(pth[i],NULL);
+	pool_wait(&group);
 	free(rp);
-	free(pth);
 	rp=NULL;
-	pth=NULL;
 #ifdef DEBUG
  	fprintf(stdout,"Done.\n");
 #endif
@@ -11,8 +11,6 @@ typedef struct {
 	int w;
 } StackTintRenderingParams;
 
-#include <pthread.h>
-
 void *StackRenderingThread(void *arg);
 
 void stacktint(XImage *image, unsigned char *tint, unsigned int num_threads);